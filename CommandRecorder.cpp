@@ -0,0 +1,155 @@
+﻿#include "CommandRecorder.hpp"
+#include "Tracer.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+CommandRecorder::CommandRecorder(VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount, uint32_t partitionCount)
+    : m_device(device)
+{
+    m_partitions.resize(std::clamp(partitionCount, 1u, s_maxPartitions));
+    m_recorded.resize(m_partitions.size());
+    for (auto& partition : m_partitions) {
+        partition.commandPools.resize(frameCount);
+        partition.commandBuffers.resize(frameCount);
+        for (uint32_t frame = 0; frame < frameCount; ++frame) {
+            // 命令缓冲区每帧随整个池一起重置, 不需要 RESET_COMMAND_BUFFER_BIT
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIndex;
+            if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &partition.commandPools[frame]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create secondary command pool!");
+            }
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = partition.commandPools[frame];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+            if (vkAllocateCommandBuffers(m_device, &allocInfo, &partition.commandBuffers[frame]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate secondary command buffers!");
+            }
+        }
+    }
+
+    for (uint32_t partition = 1; partition < m_partitions.size(); ++partition) {
+        m_workers.emplace_back(&CommandRecorder::workerLoop, this, partition);
+    }
+    spdlog::info("Recording secondary command buffers over {} partitions", m_partitions.size());
+}
+
+CommandRecorder::~CommandRecorder()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_start.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+
+    for (auto& partition : m_partitions) {
+        for (auto commandPool : partition.commandPools) {
+            vkDestroyCommandPool(m_device, commandPool, nullptr);
+        }
+    }
+}
+
+uint32_t CommandRecorder::choosePartitionCount(uint32_t requested)
+{
+    if (requested > 0) {
+        return std::min(requested, s_maxPartitions);
+    }
+    return std::clamp(std::thread::hardware_concurrency(), 1u, s_maxPartitions);
+}
+
+const std::vector<VkCommandBuffer>& CommandRecorder::record(uint32_t frameIndex, const VkCommandBufferInheritanceInfo& inheritance, const RecordFunction& function)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_frameIndex = frameIndex;
+        m_inheritance = &inheritance;
+        m_function = &function;
+        m_error = nullptr;
+        m_pending = static_cast<uint32_t>(m_workers.size());
+        ++m_generation;
+    }
+    m_start.notify_all();
+
+    // 调用线程录制第 0 个分区, 然后等待工作线程
+    std::exception_ptr error;
+    try {
+        recordPartition(0);
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]() { return m_pending == 0; });
+    m_function = nullptr;
+    m_inheritance = nullptr;
+    if (!error) {
+        error = m_error;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return m_recorded;
+}
+
+void CommandRecorder::workerLoop(uint32_t partition)
+{
+    Tracer::getInstance().setThreadName("recorder " + std::to_string(partition));
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait(lock, [this, seenGeneration]() { return m_stopping || m_generation != seenGeneration; });
+            if (m_stopping) return;
+            seenGeneration = m_generation;
+        }
+
+        std::exception_ptr error;
+        try {
+            recordPartition(partition);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (error && !m_error) {
+                m_error = error;
+            }
+            --m_pending;
+        }
+        m_done.notify_one();
+    }
+}
+
+void CommandRecorder::recordPartition(uint32_t partition)
+{
+    TRACE_SCOPE("frame", "record partition");
+    // 该帧的 fence 已经等待过, 池中的命令缓冲区不再被 GPU 使用
+    vkResetCommandPool(m_device, m_partitions[partition].commandPools[m_frameIndex], 0);
+    VkCommandBuffer commandBuffer = m_partitions[partition].commandBuffers[m_frameIndex];
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = m_inheritance;
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording secondary command buffer!");
+    }
+    (*m_function)(partition, commandBuffer);
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record secondary command buffer!");
+    }
+    m_recorded[partition] = commandBuffer;
+}
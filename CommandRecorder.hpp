@@ -0,0 +1,60 @@
+﻿#pragma once
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 多线程录制次级命令缓冲区: 每个分区在各自的线程上录制, 每个分区每个飞行帧一个命令池,
+// 该帧的 fence 触发后整池重置; 第 0 个分区在调用线程上录制, 其余分区由常驻的工作线程录制
+class CommandRecorder {
+public:
+    static const uint32_t s_maxPartitions = 16;
+
+    using RecordFunction = std::function<void(uint32_t partition, VkCommandBuffer commandBuffer)>;
+
+    CommandRecorder(VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount, uint32_t partitionCount);
+    CommandRecorder(const CommandRecorder&) = delete;
+    CommandRecorder& operator=(const CommandRecorder&) = delete;
+    ~CommandRecorder();
+
+    // 0 表示按 CPU 核心数选择
+    static uint32_t choosePartitionCount(uint32_t requested);
+
+    uint32_t partitionCount() const noexcept { return static_cast<uint32_t>(m_partitions.size()); }
+
+    // 并行录制所有分区的次级命令缓冲区, 全部录制完成后才返回; 返回的命令缓冲区按分区顺序排列,
+    // 直接交给 vkCmdExecuteCommands. 某个分区抛出的异常在这里重新抛出
+    const std::vector<VkCommandBuffer>& record(uint32_t frameIndex, const VkCommandBufferInheritanceInfo& inheritance, const RecordFunction& function);
+
+private:
+    struct Partition {
+        std::vector<VkCommandPool> commandPools;
+        std::vector<VkCommandBuffer> commandBuffers;
+    };
+
+    void workerLoop(uint32_t partition);
+    void recordPartition(uint32_t partition);
+
+    VkDevice m_device;
+    std::vector<Partition> m_partitions;
+    std::vector<std::thread> m_workers;
+    std::vector<VkCommandBuffer> m_recorded;
+
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    uint64_t m_generation = 0;
+    uint32_t m_pending = 0;
+    bool m_stopping = false;
+    std::exception_ptr m_error;
+
+    // 当前这一轮录制的参数, 只在 record 调用期间有效
+    uint32_t m_frameIndex = 0;
+    const VkCommandBufferInheritanceInfo* m_inheritance = nullptr;
+    const RecordFunction* m_function = nullptr;
+};
@@ -0,0 +1,79 @@
+﻿#include "FrameAllocator.hpp"
+
+#include <stdexcept>
+
+FrameAllocator::FrameAllocator(VmaAllocator allocator, VkDeviceSize capacity, VkDeviceSize alignment, VkBufferUsageFlags usage, VkMemoryPropertyFlags preferredProperties)
+    : m_allocator(allocator), m_capacity(capacity), m_alignment(alignment > 0 ? alignment : 1)
+{
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = capacity;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_UNKNOWN;
+    allocCreateInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    allocCreateInfo.preferredFlags = preferredProperties;
+    allocCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocInfo{};
+    if (vmaCreateBuffer(m_allocator, &bufferInfo, &allocCreateInfo, &m_buffer, &m_allocation, &allocInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create frame allocator buffer!");
+    }
+    m_mapped = static_cast<uint8_t*>(allocInfo.pMappedData);
+}
+
+FrameAllocator::~FrameAllocator()
+{
+    vmaDestroyBuffer(m_allocator, m_buffer, m_allocation);
+}
+
+FrameAllocator::Allocation FrameAllocator::allocate(VkDeviceSize size)
+{
+    Allocation allocation;
+    if (!tryAllocate(size, allocation)) {
+        throw std::runtime_error("failed to allocate per-frame data: frame allocator is full!");
+    }
+    return allocation;
+}
+
+bool FrameAllocator::tryAllocate(VkDeviceSize size, Allocation& allocation)
+{
+    if (size > m_capacity) return false;
+
+    VkDeviceSize offset = (m_head + m_alignment - 1) / m_alignment * m_alignment;
+    // 放不下时回绕到开头, 跳过的末尾随本帧一起释放
+    if (offset + size > m_capacity) {
+        offset = 0;
+    }
+    VkDeviceSize consumed = offset >= m_head ? offset + size - m_head : m_capacity - m_head + size;
+    if (m_used + consumed > m_capacity) return false;
+
+    m_head = offset + size;
+    m_used += consumed;
+    m_frameSize += consumed;
+    allocation = { m_mapped + offset, offset };
+    return true;
+}
+
+void FrameAllocator::flush(const Allocation& allocation, VkDeviceSize size)
+{
+    vmaFlushAllocation(m_allocator, m_allocation, allocation.offset, size);
+}
+
+void FrameAllocator::endFrame(uint64_t submitSerial)
+{
+    if (m_frameSize == 0) return;
+    m_frames.push_back({ submitSerial, m_frameSize });
+    m_frameSize = 0;
+}
+
+void FrameAllocator::collect(uint64_t completedSerial)
+{
+    // 提交按顺序完成, 各帧的空间在环里首尾相接, 从最旧的一帧开始释放
+    while (!m_frames.empty() && m_frames.front().submitSerial <= completedSerial) {
+        m_used -= m_frames.front().size;
+        m_frames.pop_front();
+    }
+}
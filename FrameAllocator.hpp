@@ -0,0 +1,64 @@
+﻿#pragma once
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+#include <cstdint>
+#include <deque>
+
+// 每帧临时数据的环形分配器: 一个持久映射的 CPU 可见缓冲区, 按提交序号回收; 帧常量用动态偏移的描述符绑定,
+// 帧内的小块上传也从这里取暂存空间. 一帧的分配在 endFrame 时记到该帧的提交序号上, 提交完成后由 collect 释放
+class FrameAllocator {
+public:
+    struct Allocation {
+        void* data = nullptr;
+        VkDeviceSize offset = 0;
+    };
+
+    // alignment 是每次分配的起点对齐, 用作动态偏移时不小于 minUniformBufferOffsetAlignment
+    FrameAllocator(VmaAllocator allocator, VkDeviceSize capacity, VkDeviceSize alignment, VkBufferUsageFlags usage, VkMemoryPropertyFlags preferredProperties);
+    FrameAllocator(const FrameAllocator&) = delete;
+    FrameAllocator& operator=(const FrameAllocator&) = delete;
+    ~FrameAllocator();
+
+    VkBuffer buffer() const noexcept { return m_buffer; }
+
+    // 空间不足说明在飞行的帧用量超过了容量, 抛出异常; 写入后调用 flush
+    Allocation allocate(VkDeviceSize size);
+    // 与 allocate 相同, 但空间不足时返回 false, 用于大小不受控制、可以另找暂存空间的分配
+    bool tryAllocate(VkDeviceSize size, Allocation& allocation);
+    // 非 coherent 的内存需要显式 flush, coherent 时什么也不做
+    void flush(const Allocation& allocation, VkDeviceSize size);
+
+    // 分配并写入一份数据, 返回偏移
+    template <typename T>
+    uint32_t push(const T& value) {
+        Allocation allocation = allocate(sizeof(T));
+        *static_cast<T*>(allocation.data) = value;
+        flush(allocation, sizeof(T));
+        return static_cast<uint32_t>(allocation.offset);
+    }
+
+    // 上一次 endFrame 之后的分配都由序号为 submitSerial 的提交读取
+    void endFrame(uint64_t submitSerial);
+    // 释放序号不大于 completedSerial 的提交所用的空间
+    void collect(uint64_t completedSerial);
+
+private:
+    struct Frame {
+        uint64_t submitSerial;
+        VkDeviceSize size;
+    };
+
+    VmaAllocator m_allocator;
+    VkBuffer m_buffer = VK_NULL_HANDLE;
+    VmaAllocation m_allocation = VK_NULL_HANDLE;
+    uint8_t* m_mapped = nullptr;
+    VkDeviceSize m_capacity;
+    VkDeviceSize m_alignment;
+
+    // m_head 是下一次分配的位置; m_used 包括回绕时跳过的末尾
+    VkDeviceSize m_head = 0;
+    VkDeviceSize m_used = 0;
+    VkDeviceSize m_frameSize = 0;
+    std::deque<Frame> m_frames;
+};
@@ -0,0 +1,207 @@
+﻿#include "FrameCapture.hpp"
+#include "Tracer.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+ImageSequenceWriter::Format ImageSequenceWriter::parseFormat(const std::string& name)
+{
+    if (name == "ppm") return Format::PPM;
+    if (name == "png") return Format::PNG;
+    throw std::invalid_argument("Unsupported capture format: " + name);
+}
+
+ImageSequenceWriter::ImageSequenceWriter(const std::filesystem::path& directory, Format format)
+    : m_directory(directory), m_format(format)
+{
+    std::filesystem::create_directories(m_directory);
+    m_worker = std::thread(&ImageSequenceWriter::workerLoop, this);
+}
+
+ImageSequenceWriter::~ImageSequenceWriter()
+{
+    finish();
+}
+
+void ImageSequenceWriter::submit(uint64_t frameNumber, uint32_t width, uint32_t height, bool bgra, const uint8_t* pixels, std::function<void()> onRelease)
+{
+    Job job;
+    job.frameNumber = frameNumber;
+    job.width = width;
+    job.height = height;
+    job.bgra = bgra;
+    job.pixels = pixels;
+    job.onRelease = std::move(onRelease);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_condition.notify_one();
+}
+
+void ImageSequenceWriter::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_one();
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+}
+
+void ImageSequenceWriter::workerLoop()
+{
+    Tracer::getInstance().setThreadName("capture writer");
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+            // 停止前先把队列里的帧全部写完
+            if (m_jobs.empty()) return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        writeFrame(job);
+    }
+}
+
+void ImageSequenceWriter::writeFrame(const Job& job)
+{
+    TRACE_FUNCTION("capture");
+    // 先转换成紧凑的 RGB 再释放暂存缓冲区, 文件 I/O 不占用回读槽位
+    std::vector<uint8_t> rgb(static_cast<size_t>(job.width) * job.height * 3);
+    const size_t pixelCount = static_cast<size_t>(job.width) * job.height;
+    const size_t r = job.bgra ? 2 : 0;
+    const size_t b = job.bgra ? 0 : 2;
+    for (size_t i = 0; i < pixelCount; ++i) {
+        rgb[i * 3 + 0] = job.pixels[i * 4 + r];
+        rgb[i * 3 + 1] = job.pixels[i * 4 + 1];
+        rgb[i * 3 + 2] = job.pixels[i * 4 + b];
+    }
+    if (job.onRelease) {
+        job.onRelease();
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "frame_%06llu.%s", static_cast<unsigned long long>(job.frameNumber), m_format == Format::PNG ? "png" : "ppm");
+    std::filesystem::path file = m_directory / name;
+
+    bool written = m_format == Format::PNG ? writePNG(file, job.width, job.height, rgb) : writePPM(file, job.width, job.height, rgb);
+    if (written) {
+        ++m_writtenCount;
+    }
+    else {
+        spdlog::warn("Failed to write captured frame {}", file.string());
+    }
+}
+
+bool ImageSequenceWriter::writePPM(const std::filesystem::path& file, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgb)
+{
+    std::ofstream out(file, std::ios::out | std::ios::binary);
+    if (!out.is_open()) return false;
+    out << "P6\n" << width << " " << height << "\n255\n";
+    out.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+    return out.good();
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static void writeChunk(std::ofstream& out, const char type[4], const std::vector<uint8_t>& payload)
+{
+    std::vector<uint8_t> chunk;
+    chunk.reserve(payload.size() + 12);
+    appendBigEndian(chunk, static_cast<uint32_t>(payload.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), payload.begin(), payload.end());
+    appendBigEndian(chunk, crc32(chunk.data() + 4, payload.size() + 4));
+    out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+bool ImageSequenceWriter::writePNG(const std::filesystem::path& file, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgb)
+{
+    std::ofstream out(file, std::ios::out | std::ios::binary);
+    if (!out.is_open()) return false;
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    std::vector<uint8_t> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    header.push_back(8); // bit depth
+    header.push_back(2); // truecolour
+    header.push_back(0); // deflate
+    header.push_back(0); // adaptive filtering
+    header.push_back(0); // no interlace
+    writeChunk(out, "IHDR", header);
+
+    // 每行前加过滤类型 0, 再用不压缩的 deflate 块封装, 避免引入 zlib 依赖, 写盘速度优先
+    const size_t rowSize = static_cast<size_t>(width) * 3;
+    std::vector<uint8_t> raw;
+    raw.reserve((rowSize + 1) * height);
+    for (uint32_t y = 0; y < height; ++y) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb.begin() + y * rowSize, rgb.begin() + (y + 1) * rowSize);
+    }
+
+    std::vector<uint8_t> zlib;
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    uint32_t adlerA = 1, adlerB = 0;
+    for (size_t offset = 0; ; ) {
+        size_t blockSize = std::min<size_t>(raw.size() - offset, 65535);
+        bool last = offset + blockSize == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(static_cast<uint8_t>(blockSize));
+        zlib.push_back(static_cast<uint8_t>(blockSize >> 8));
+        zlib.push_back(static_cast<uint8_t>(~blockSize));
+        zlib.push_back(static_cast<uint8_t>(~blockSize >> 8));
+        for (size_t i = 0; i < blockSize; ++i) {
+            uint8_t value = raw[offset + i];
+            zlib.push_back(value);
+            adlerA = (adlerA + value) % 65521;
+            adlerB = (adlerB + adlerA) % 65521;
+        }
+        offset += blockSize;
+        if (last) break;
+    }
+    appendBigEndian(zlib, (adlerB << 16) | adlerA);
+    writeChunk(out, "IDAT", zlib);
+    writeChunk(out, "IEND", {});
+
+    return out.good();
+}
@@ -0,0 +1,59 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 在后台线程把回读的帧写成 PPM/PNG 图像序列, 渲染线程只负责提交已完成拷贝的像素指针
+class ImageSequenceWriter {
+public:
+    enum class Format {
+        PPM = 0,
+        PNG = 1,
+    };
+
+    static Format parseFormat(const std::string& name);
+
+    ImageSequenceWriter(const std::filesystem::path& directory, Format format);
+    ImageSequenceWriter(const ImageSequenceWriter&) = delete;
+    ImageSequenceWriter& operator=(const ImageSequenceWriter&) = delete;
+    ~ImageSequenceWriter();
+
+    // pixels 在 onRelease 被调用之前必须保持有效; onRelease 在后台线程上调用
+    void submit(uint64_t frameNumber, uint32_t width, uint32_t height, bool bgra, const uint8_t* pixels, std::function<void()> onRelease);
+
+    // 等待所有已提交的帧写完并结束后台线程
+    void finish();
+
+    uint64_t writtenCount() const noexcept { return m_writtenCount.load(); }
+
+private:
+    struct Job {
+        uint64_t frameNumber = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        bool bgra = false;
+        const uint8_t* pixels = nullptr;
+        std::function<void()> onRelease;
+    };
+
+    void workerLoop();
+    void writeFrame(const Job& job);
+    static bool writePPM(const std::filesystem::path& file, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgb);
+    static bool writePNG(const std::filesystem::path& file, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgb);
+
+    std::filesystem::path m_directory;
+    Format m_format;
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Job> m_jobs;
+    bool m_stopping = false;
+    std::atomic<uint64_t> m_writtenCount = 0;
+};
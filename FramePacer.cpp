@@ -0,0 +1,169 @@
+﻿#include "FramePacer.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+// 醒来后到提交之间的安全余量, 覆盖系统睡眠精度和耗时抖动
+static constexpr double s_wakeMarginMS = 1.5;
+// Auto 模式每隔多少帧评估一次; 回退到吞吐模式后的冷却时间每次翻倍, 避免在临界负载下反复切换
+static constexpr uint32_t s_evaluateFrames = 120;
+static constexpr auto s_minAutoCooldown = std::chrono::seconds(10);
+static constexpr auto s_maxAutoCooldown = std::chrono::seconds(80);
+static constexpr auto s_reportInterval = std::chrono::seconds(5);
+
+static double ema(double average, double sample)
+{
+    return average == 0.0 ? sample : average * 0.9 + sample * 0.1;
+}
+
+static double toMS(FramePacer::Clock::duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+FramePacer::Mode FramePacer::parseMode(const std::string& name)
+{
+    if (name == "latency") return Mode::Latency;
+    if (name == "throughput") return Mode::Throughput;
+    if (name == "auto") return Mode::Auto;
+    throw std::invalid_argument("Unsupported pacing mode: " + name);
+}
+
+const char* FramePacer::modeName(Mode mode)
+{
+    switch (mode) {
+    case Mode::Latency: return "latency";
+    case Mode::Throughput: return "throughput";
+    default: return "auto";
+    }
+}
+
+FramePacer::FramePacer(Mode mode)
+    : m_mode(mode), m_lowLatency(mode == Mode::Latency), m_cooldown(s_minAutoCooldown)
+{
+    m_lastReport = Clock::now();
+}
+
+void FramePacer::setRefreshRate(double hz)
+{
+    if (hz > 0.0) {
+        m_refreshIntervalMS = 1000.0 / hz;
+    }
+}
+
+void FramePacer::sleepUntilWake()
+{
+    if (!m_lowLatency) return;
+
+    // 以刷新间隔为网格推进截止时刻, 醒来时刻 = 截止时刻 - (CPU + GPU 耗时) - 余量
+    auto now = Clock::now();
+    auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(m_refreshIntervalMS));
+    auto work = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(m_cpuMS + m_gpuMS + s_wakeMarginMS));
+    if (m_nextDeadline < now + work) {
+        // 已经赶不上当前截止时刻, 对齐到之后最近的一个
+        auto behind = now + work - m_nextDeadline;
+        m_nextDeadline += interval * (behind / interval + 1);
+    }
+    auto wake = m_nextDeadline - work;
+    if (wake > now) {
+        std::this_thread::sleep_until(wake);
+    }
+    m_nextDeadline += interval;
+}
+
+void FramePacer::onInputSampled()
+{
+    m_inputTime = Clock::now();
+}
+
+void FramePacer::onSubmit(uint32_t frameIndex)
+{
+    auto now = Clock::now();
+    m_cpuMS = ema(m_cpuMS, toMS(now - m_inputTime));
+    m_inputTimes[frameIndex] = m_inputTime;
+    m_submitTimes[frameIndex] = now;
+    m_pending[frameIndex] = true;
+}
+
+void FramePacer::onFrameComplete(uint32_t frameIndex, bool blocked)
+{
+    if (!m_pending[frameIndex]) return;
+    m_pending[frameIndex] = false;
+
+    // 没有等待时 fence 早已触发, 此刻只是完成时间的上界
+    auto now = Clock::now();
+    if (blocked) {
+        m_gpuMS = ema(m_gpuMS, toMS(now - m_submitTimes[frameIndex]));
+        if (m_lastComplete != Clock::time_point{}) {
+            m_completeIntervalMS = ema(m_completeIntervalMS, toMS(now - m_lastComplete));
+        }
+        m_lastComplete = now;
+    }
+
+    // 从采样输入到观察到帧的 GPU 工作完成, 不包含呈现排队和显示器扫描输出的时间
+    double inputToGpuMS = toMS(now - m_inputTimes[frameIndex]);
+    m_inputToGpuSumMS += inputToGpuMS;
+    m_inputToGpuMaxMS = std::max(m_inputToGpuMaxMS, inputToGpuMS);
+    ++m_inputToGpuSamples;
+
+    if (++m_framesSinceEvaluate >= s_evaluateFrames) {
+        m_framesSinceEvaluate = 0;
+        evaluate(now);
+    }
+    if (now - m_lastReport >= s_reportInterval) {
+        report(now);
+    }
+}
+
+bool FramePacer::consumeSettingsChanged()
+{
+    bool changed = m_settingsChanged;
+    m_settingsChanged = false;
+    if (changed) {
+        // 调用方切换前会等待所有飞行帧完成, 旧槽位上的记录不再有意义
+        m_pending.fill(false);
+    }
+    return changed;
+}
+
+void FramePacer::evaluate(Clock::time_point now)
+{
+    if (m_mode != Mode::Auto) return;
+
+    if (m_lowLatency) {
+        // 单个飞行帧时 CPU 和 GPU 串行, 两者之和超出刷新间隔就会掉帧
+        if (m_cpuMS + m_gpuMS + s_wakeMarginMS > m_refreshIntervalMS * 0.9) {
+            m_lowLatency = false;
+            m_settingsChanged = true;
+            m_cooldownUntil = now + m_cooldown;
+            m_cooldown = std::min<Clock::duration>(m_cooldown * 2, s_maxAutoCooldown);
+            spdlog::info("Frame pacing: {:.2f} ms of work does not fit in {:.2f} ms, switching to throughput",
+                m_cpuMS + m_gpuMS, m_refreshIntervalMS);
+        }
+    }
+    else if (now >= m_cooldownUntil) {
+        // FIFO 下 GPU 时间包含排队等待, 只能依据完成间隔是否跟上刷新率以及 CPU 是否有富余来判断
+        if (m_completeIntervalMS > 0.0 && m_completeIntervalMS < m_refreshIntervalMS * 1.1 && m_cpuMS < m_refreshIntervalMS * 0.5) {
+            m_lowLatency = true;
+            m_settingsChanged = true;
+            m_gpuMS = 0.0;
+            m_nextDeadline = now;
+            spdlog::info("Frame pacing: keeping up with {:.2f} ms refresh, trying latency mode", m_refreshIntervalMS);
+        }
+    }
+}
+
+void FramePacer::report(Clock::time_point now)
+{
+    if (m_inputToGpuSamples > 0) {
+        spdlog::info("Frame pacing [{}]: {} in flight, cpu {:.2f} ms, gpu {:.2f} ms, input-to-GPU-complete {:.2f} ms avg / {:.2f} ms max",
+            m_lowLatency ? "latency" : "throughput", framesInFlight(), m_cpuMS, m_gpuMS,
+            m_inputToGpuSumMS / m_inputToGpuSamples, m_inputToGpuMaxMS);
+    }
+    m_inputToGpuSumMS = 0.0;
+    m_inputToGpuMaxMS = 0.0;
+    m_inputToGpuSamples = 0;
+    m_lastReport = now;
+}
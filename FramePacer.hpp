@@ -0,0 +1,71 @@
+﻿#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// 帧节奏控制: 低延迟模式只保留一个飞行帧, 并按测得的 CPU/GPU 耗时推迟输入采样;
+// 吞吐模式保留三个飞行帧配合 FIFO 呈现; 自动模式根据测得的帧时间在两者之间切换
+class FramePacer {
+public:
+    enum class Mode {
+        Latency = 0,
+        Throughput = 1,
+        Auto = 2,
+    };
+    using Clock = std::chrono::steady_clock;
+
+    static const uint32_t s_maxFramesInFlight = 3;
+
+    static Mode parseMode(const std::string& name);
+    static const char* modeName(Mode mode);
+
+    explicit FramePacer(Mode mode);
+
+    void setRefreshRate(double hz);
+
+    // 当前实际生效的策略, Auto 模式下会在运行中变化
+    bool lowLatency() const noexcept { return m_lowLatency; }
+    double refreshIntervalMS() const noexcept { return m_refreshIntervalMS; }
+    uint32_t framesInFlight() const noexcept { return m_lowLatency ? 1 : s_maxFramesInFlight; }
+
+    // 低延迟模式下在采样输入之前调用, 睡到刚好能在下一次刷新前完成这一帧的时刻
+    void sleepUntilWake();
+    // 采样输入(glfwPollEvents)之后立即调用
+    void onInputSampled();
+    void onSubmit(uint32_t frameIndex);
+    // frameIndex 对应的 fence 触发后调用; blocked 表示 CPU 确实等待过它, 此时的时刻才能近似为 GPU 完成时刻
+    void onFrameComplete(uint32_t frameIndex, bool blocked);
+
+    // 生效策略改变时返回 true 一次, 调用方据此调整飞行帧数和呈现模式
+    bool consumeSettingsChanged();
+
+private:
+    void evaluate(Clock::time_point now);
+    void report(Clock::time_point now);
+
+    Mode m_mode;
+    bool m_lowLatency;
+    bool m_settingsChanged = false;
+    double m_refreshIntervalMS = 1000.0 / 60.0;
+
+    // 指数滑动平均
+    double m_cpuMS = 0.0;
+    double m_gpuMS = 0.0;
+    double m_completeIntervalMS = 0.0;
+
+    Clock::time_point m_inputTime;
+    Clock::time_point m_nextDeadline;
+    Clock::time_point m_lastComplete;
+    Clock::time_point m_cooldownUntil;
+    Clock::duration m_cooldown;
+    Clock::time_point m_lastReport;
+    std::array<Clock::time_point, s_maxFramesInFlight> m_inputTimes{};
+    std::array<Clock::time_point, s_maxFramesInFlight> m_submitTimes{};
+    std::array<bool, s_maxFramesInFlight> m_pending{};
+
+    uint32_t m_framesSinceEvaluate = 0;
+    double m_inputToGpuSumMS = 0.0;
+    double m_inputToGpuMaxMS = 0.0;
+    uint32_t m_inputToGpuSamples = 0;
+};
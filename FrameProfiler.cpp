@@ -0,0 +1,133 @@
+﻿#include "FrameProfiler.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cmath>
+
+static constexpr auto s_reportInterval = std::chrono::seconds(10);
+
+static double toMS(uint64_t nanoseconds)
+{
+    return static_cast<double>(nanoseconds) / 1e6;
+}
+
+uint32_t LatencyHistogram::bucketIndex(uint64_t nanoseconds) noexcept
+{
+    if (nanoseconds < s_subBucketCount) {
+        return static_cast<uint32_t>(nanoseconds);
+    }
+
+    // 最高位决定所在的 2 的幂区间, 其后 s_subBucketBits 位决定子桶
+    uint32_t highestBit = 63;
+    while ((nanoseconds >> highestBit) == 0) {
+        --highestBit;
+    }
+    uint32_t shift = highestBit - s_subBucketBits;
+    if (shift > s_maxShift) {
+        return s_bucketCount - 1;
+    }
+    uint32_t mantissa = static_cast<uint32_t>(nanoseconds >> shift);
+    return (shift + 1) * s_subBucketCount + (mantissa - s_subBucketCount);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(uint32_t index) noexcept
+{
+    if (index < s_subBucketCount) {
+        return index;
+    }
+    uint32_t shift = index / s_subBucketCount - 1;
+    uint64_t mantissa = s_subBucketCount + index % s_subBucketCount;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) noexcept
+{
+    m_counts[bucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (nanoseconds > max && !m_max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+    }
+}
+
+LatencyHistogram::Summary LatencyHistogram::drain() noexcept
+{
+    std::array<uint64_t, s_bucketCount> counts;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < s_bucketCount; ++i) {
+        counts[i] = m_counts[i].exchange(0, std::memory_order_relaxed);
+        count += counts[i];
+    }
+    uint64_t sum = m_sum.exchange(0, std::memory_order_relaxed);
+    uint64_t max = m_max.exchange(0, std::memory_order_relaxed);
+
+    Summary summary;
+    summary.count = count;
+    if (count == 0) return summary;
+
+    // 百分位取桶的上界, 保证报告值不会低估; 最大值单独记录, 不受分桶精度影响
+    const double ranks[] = { 0.5, 0.99, 0.999 };
+    double* targets[] = { &summary.p50MS, &summary.p99MS, &summary.p999MS };
+    uint64_t seen = 0;
+    size_t next = 0;
+    for (uint32_t i = 0; i < s_bucketCount && next < 3; ++i) {
+        seen += counts[i];
+        while (next < 3 && seen > 0 && seen >= static_cast<uint64_t>(std::ceil(ranks[next] * count))) {
+            *targets[next] = toMS(std::min(bucketUpperBound(i), max));
+            ++next;
+        }
+    }
+    summary.meanMS = toMS(sum) / count;
+    summary.maxMS = toMS(max);
+    return summary;
+}
+
+const char* FrameProfiler::phaseName(Phase phase)
+{
+    switch (phase) {
+    case Phase::PollEvents: return "poll events";
+    case Phase::Animation: return "animation";
+    case Phase::WaitFence: return "wait fence";
+    case Phase::Acquire: return "acquire";
+    case Phase::UpdateUniforms: return "uniforms";
+    case Phase::SceneUpdate: return "scene update";
+    case Phase::Record: return "record";
+    case Phase::Submit: return "submit";
+    case Phase::Present: return "present";
+    default: return "unknown";
+    }
+}
+
+FrameProfiler::FrameProfiler()
+    : m_lastReport(Clock::now())
+{
+}
+
+void FrameProfiler::record(Phase phase, Clock::duration duration) noexcept
+{
+    int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    m_phases[static_cast<size_t>(phase)].record(nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0);
+}
+
+void FrameProfiler::onFrameEnd()
+{
+    ++m_framesSinceReport;
+    if (Clock::now() - m_lastReport >= s_reportInterval) {
+        report();
+    }
+}
+
+void FrameProfiler::report()
+{
+    Clock::time_point now = Clock::now();
+    double seconds = std::chrono::duration<double>(now - m_lastReport).count();
+    spdlog::info("CPU frame phases over {} frames ({:.1f} s):", m_framesSinceReport, seconds);
+    for (size_t i = 0; i < m_phases.size(); ++i) {
+        LatencyHistogram::Summary s = m_phases[i].drain();
+        if (s.count == 0) continue;
+        spdlog::info("  {:<12} n {:>6}, mean {:.3f} ms, p50 {:.3f} ms, p99 {:.3f} ms, p99.9 {:.3f} ms, max {:.3f} ms",
+            phaseName(static_cast<Phase>(i)), s.count, s.meanMS, s.p50MS, s.p99MS, s.p999MS, s.maxMS);
+    }
+    m_lastReport = now;
+    m_framesSinceReport = 0;
+}
@@ -0,0 +1,96 @@
+﻿#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "Tracer.hpp"
+
+// 对数-线性分桶的延迟直方图(HDR Histogram 的简化版): 每个 2 的幂区间再线性分成 32 个子桶, 相对误差约 3%;
+// 记录只做原子加, 可以从任意线程无锁调用
+class LatencyHistogram {
+public:
+    struct Summary {
+        uint64_t count = 0;
+        double meanMS = 0.0;
+        double p50MS = 0.0;
+        double p99MS = 0.0;
+        double p999MS = 0.0;
+        double maxMS = 0.0;
+    };
+
+    void record(uint64_t nanoseconds) noexcept;
+
+    // 取出当前窗口的统计并清零, 与并发的 record 交错时最多把个别样本计入下一个窗口
+    Summary drain() noexcept;
+
+private:
+    static const uint32_t s_subBucketBits = 5;
+    static const uint32_t s_subBucketCount = 1u << s_subBucketBits;
+    // 覆盖到 2^40 纳秒(约 18 分钟), 更大的值计入最后一个桶
+    static const uint32_t s_maxShift = 40 - s_subBucketBits;
+    static const uint32_t s_bucketCount = (s_maxShift + 2) * s_subBucketCount;
+
+    static uint32_t bucketIndex(uint64_t nanoseconds) noexcept;
+    static uint64_t bucketUpperBound(uint32_t index) noexcept;
+
+    std::array<std::atomic<uint64_t>, s_bucketCount> m_counts{};
+    std::atomic<uint64_t> m_sum{ 0 };
+    std::atomic<uint64_t> m_max{ 0 };
+};
+
+// 按帧阶段统计 CPU 耗时, 每隔一段时间通过 spdlog 输出各阶段的 p50/p99/p99.9
+class FrameProfiler {
+public:
+    enum class Phase {
+        PollEvents = 0,
+        Animation,
+        WaitFence,
+        Acquire,
+        UpdateUniforms,
+        SceneUpdate,
+        Record,
+        Submit,
+        Present,
+        Count,
+    };
+    using Clock = std::chrono::steady_clock;
+
+    static const char* phaseName(Phase phase);
+
+    FrameProfiler();
+
+    void record(Phase phase, Clock::duration duration) noexcept;
+
+    // 每帧结束时调用, 距上次输出超过间隔时输出一次报告
+    void onFrameEnd();
+    // 立即输出当前窗口(例如离屏渲染结束时)
+    void report();
+
+private:
+    std::array<LatencyHistogram, static_cast<size_t>(Phase::Count)> m_phases;
+    Clock::time_point m_lastReport;
+    uint64_t m_framesSinceReport = 0;
+};
+
+// 作用域计时器, 析构时把经过的时间计入对应阶段, 追踪开启时同时写入追踪时间线
+class ScopedPhaseTimer {
+public:
+    ScopedPhaseTimer(FrameProfiler& profiler, FrameProfiler::Phase phase)
+        : m_profiler(profiler), m_phase(phase), m_start(FrameProfiler::Clock::now())
+    {
+    }
+    ScopedPhaseTimer(const ScopedPhaseTimer&) = delete;
+    ScopedPhaseTimer& operator=(const ScopedPhaseTimer&) = delete;
+    ~ScopedPhaseTimer()
+    {
+        FrameProfiler::Clock::time_point end = FrameProfiler::Clock::now();
+        m_profiler.record(m_phase, end - m_start);
+        Tracer::getInstance().complete("frame", FrameProfiler::phaseName(m_phase), m_start, end);
+    }
+
+private:
+    FrameProfiler& m_profiler;
+    FrameProfiler::Phase m_phase;
+    FrameProfiler::Clock::time_point m_start;
+};
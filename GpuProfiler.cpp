@@ -0,0 +1,243 @@
+﻿#include "GpuProfiler.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+static const char* s_frameScopeName = "frame";
+
+// 设备名来自驱动, 可能含有引号、反斜杠或控制字符, 按 JSON 字符串规则转义
+static void writeEscaped(std::ofstream& out, const std::string& text)
+{
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+            out << escaped;
+        }
+        else {
+            out << c;
+        }
+    }
+}
+
+GpuProfiler::GpuProfiler(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t frameCount)
+    : m_device(device)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    m_deviceName = properties.deviceName;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+    if (validBits == 0 || properties.limits.timestampPeriod == 0.0f) {
+        spdlog::warn("The graphics queue of {} does not support timestamps, GPU profiling disabled", m_deviceName);
+        return;
+    }
+    m_timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    m_timestampPeriodNS = properties.limits.timestampPeriod;
+
+    m_frames.resize(frameCount);
+    for (auto& frame : m_frames) {
+        VkQueryPoolCreateInfo queryPoolInfo{};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = s_maxQueriesPerFrame;
+
+        if (vkCreateQueryPool(m_device, &queryPoolInfo, nullptr, &frame.queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timestamp query pool!");
+        }
+    }
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    for (auto& frame : m_frames) {
+        vkDestroyQueryPool(m_device, frame.queryPool, nullptr);
+    }
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+    if (!enabled()) return;
+
+    m_recording = &m_frames[frameIndex];
+    m_recording->scopes.clear();
+    m_recording->queryCount = 0;
+    vkCmdResetQueryPool(commandBuffer, m_recording->queryPool, 0, s_maxQueriesPerFrame);
+    beginScope(commandBuffer, s_frameScopeName);
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer commandBuffer)
+{
+    if (m_recording == nullptr) return;
+
+    endScope(commandBuffer, 0);
+    m_recording->recorded = true;
+    m_recording = nullptr;
+}
+
+uint32_t GpuProfiler::beginScope(VkCommandBuffer commandBuffer, const char* name)
+{
+    uint32_t scope = reserveScope(name);
+    writeScopeBegin(commandBuffer, scope);
+    return scope;
+}
+
+uint32_t GpuProfiler::reserveScope(const char* name)
+{
+    // 查询用完时丢弃多出的分段, 不影响已有分段
+    if (m_recording == nullptr || m_recording->queryCount + 2 > s_maxQueriesPerFrame) return UINT32_MAX;
+
+    Scope scope;
+    scope.name = name;
+    scope.beginQuery = m_recording->queryCount++;
+    scope.endQuery = m_recording->queryCount++;
+    m_recording->scopes.push_back(scope);
+    return static_cast<uint32_t>(m_recording->scopes.size() - 1);
+}
+
+void GpuProfiler::writeScopeBegin(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+    if (m_recording == nullptr || scope >= m_recording->scopes.size()) return;
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_recording->queryPool, m_recording->scopes[scope].beginQuery);
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+    if (m_recording == nullptr || scope >= m_recording->scopes.size()) return;
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_recording->queryPool, m_recording->scopes[scope].endQuery);
+}
+
+double GpuProfiler::collect(uint32_t frameIndex)
+{
+    if (!enabled()) return -1.0;
+    Frame& frame = m_frames[frameIndex];
+    if (!frame.recorded) return -1.0;
+    frame.recorded = false;
+
+    // fence 已经触发, 不带 WAIT 标志读取; 仍未就绪时丢弃这一帧而不是阻塞
+    std::vector<uint64_t> timestamps(frame.queryCount);
+    VkResult result = vkGetQueryPoolResults(m_device, frame.queryPool, 0, frame.queryCount, timestamps.size() * sizeof(uint64_t),
+        timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) return -1.0;
+
+    // 第 0 个分段是 beginFrame 开始的整帧计时
+    double frameMS = -1.0;
+    for (size_t i = 0; i < frame.scopes.size(); ++i) {
+        const Scope& scope = frame.scopes[i];
+        uint64_t ticks = (timestamps[scope.endQuery] - timestamps[scope.beginQuery]) & m_timestampMask;
+        double ms = static_cast<double>(ticks) * m_timestampPeriodNS / 1e6;
+        record(scope.name, ms);
+        if (i == 0) {
+            frameMS = ms;
+        }
+    }
+    ++m_collectedFrames;
+    return frameMS;
+}
+
+void GpuProfiler::record(const char* name, double ms)
+{
+    auto it = m_histories.find(name);
+    if (it == m_histories.end()) {
+        it = m_histories.emplace(name, History{}).first;
+        it->second.samples.reserve(s_historySize);
+        m_order.emplace_back(name);
+    }
+    History& history = it->second;
+    if (history.samples.size() < s_historySize) {
+        history.samples.push_back(ms);
+    }
+    else {
+        history.samples[history.next] = ms;
+    }
+    history.next = (history.next + 1) % s_historySize;
+    ++history.total;
+    history.lastMS = ms;
+}
+
+GpuProfiler::Stats GpuProfiler::computeStats(const History& history)
+{
+    Stats stats;
+    if (history.samples.empty()) return stats;
+
+    std::vector<double> sorted = history.samples;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (double sample : sorted) {
+        sum += sample;
+    }
+    size_t p99Index = static_cast<size_t>(std::ceil(sorted.size() * 0.99)) - 1;
+
+    stats.sampleCount = history.total;
+    stats.minMS = sorted.front();
+    stats.avgMS = sum / sorted.size();
+    stats.p99MS = sorted[std::min(p99Index, sorted.size() - 1)];
+    stats.lastMS = history.lastMS;
+    return stats;
+}
+
+GpuProfiler::Stats GpuProfiler::stats(const std::string& name) const
+{
+    auto it = m_histories.find(name);
+    return it == m_histories.end() ? Stats{} : computeStats(it->second);
+}
+
+bool GpuProfiler::writeJson(const std::filesystem::path& file) const
+{
+    std::ofstream out(file, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+        spdlog::warn("Failed to open {} for writing", file.string());
+        return false;
+    }
+
+    // 统计基于最近 s_historySize 帧的滚动窗口
+    out << std::fixed << std::setprecision(4);
+    out << "{\n";
+    out << "  \"device\": \"";
+    writeEscaped(out, m_deviceName);
+    out << "\",\n";
+    out << "  \"timestampPeriodNS\": " << m_timestampPeriodNS << ",\n";
+    out << "  \"frames\": " << m_collectedFrames << ",\n";
+    out << "  \"window\": " << s_historySize << ",\n";
+    out << "  \"scopes\": [";
+    for (size_t i = 0; i < m_order.size(); ++i) {
+        Stats s = computeStats(m_histories.at(m_order[i]));
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    { \"name\": \"";
+        writeEscaped(out, m_order[i]);
+        out << "\", \"samples\": " << s.sampleCount
+            << ", \"minMS\": " << s.minMS << ", \"avgMS\": " << s.avgMS
+            << ", \"p99MS\": " << s.p99MS << ", \"lastMS\": " << s.lastMS << " }";
+    }
+    out << "\n  ]\n}\n";
+
+    if (!out.good()) {
+        spdlog::warn("Failed to write GPU profile to {}", file.string());
+        return false;
+    }
+    spdlog::info("GPU profile of {} frames written to {}", m_collectedFrames, file.string());
+    return true;
+}
+
+void GpuProfiler::logSummary() const
+{
+    for (const auto& name : m_order) {
+        Stats s = computeStats(m_histories.at(name));
+        spdlog::info("GPU {:<12} min {:.3f} ms, avg {:.3f} ms, p99 {:.3f} ms", name, s.minMS, s.avgMS, s.p99MS);
+    }
+}
@@ -0,0 +1,84 @@
+﻿#pragma once
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 基于时间戳查询的 GPU 分段计时: 每个飞行帧一个查询池, fence 触发后不等待地读回, 按分段名字汇总成滚动统计
+class GpuProfiler {
+public:
+    struct Stats {
+        uint64_t sampleCount = 0;
+        double minMS = 0.0;
+        double avgMS = 0.0;
+        double p99MS = 0.0;
+        double lastMS = 0.0;
+    };
+
+    GpuProfiler(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t frameCount);
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+    ~GpuProfiler();
+
+    // 队列不支持时间戳时所有调用都是空操作
+    bool enabled() const noexcept { return !m_frames.empty(); }
+
+    // 在命令缓冲区开头(渲染通道之外)调用, 重置该帧的查询并开始整帧计时
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+    void endFrame(VkCommandBuffer commandBuffer);
+
+    // 分段可以嵌套; name 需要在整个程序运行期间有效, 一般是字符串字面量
+    uint32_t beginScope(VkCommandBuffer commandBuffer, const char* name);
+    void endScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+    // 只分配查询而不写时间戳, 由 writeScopeBegin 和 endScope 在其他(次级)命令缓冲区中写入;
+    // 分配必须在录制线程上完成, 之后多个线程可以同时写各自分段的时间戳
+    uint32_t reserveScope(const char* name);
+    void writeScopeBegin(VkCommandBuffer commandBuffer, uint32_t scope);
+
+    // 该帧的 fence 触发后调用, 返回整帧的 GPU 时间(毫秒), 没有可用结果时返回负数
+    double collect(uint32_t frameIndex);
+
+    Stats stats(const std::string& name) const;
+    bool writeJson(const std::filesystem::path& file) const;
+    void logSummary() const;
+
+private:
+    static const uint32_t s_maxQueriesPerFrame = 64;
+    static const size_t s_historySize = 1024;
+
+    struct Scope {
+        const char* name = nullptr;
+        uint32_t beginQuery = 0;
+        uint32_t endQuery = 0;
+    };
+    struct Frame {
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        std::vector<Scope> scopes;
+        uint32_t queryCount = 0;
+        bool recorded = false;
+    };
+    struct History {
+        std::vector<double> samples;
+        size_t next = 0;
+        uint64_t total = 0;
+        double lastMS = 0.0;
+    };
+
+    void record(const char* name, double ms);
+    static Stats computeStats(const History& history);
+
+    VkDevice m_device;
+    std::string m_deviceName;
+    double m_timestampPeriodNS = 0.0;
+    uint64_t m_timestampMask = 0;
+    std::vector<Frame> m_frames;
+    Frame* m_recording = nullptr;
+    // 按首次出现的顺序输出, 与命令缓冲区中的录制顺序一致
+    std::vector<std::string> m_order;
+    std::unordered_map<std::string, History> m_histories;
+    uint64_t m_collectedFrames = 0;
+};
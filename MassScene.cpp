@@ -0,0 +1,62 @@
+﻿#include "MassScene.hpp"
+#include "VertexPacking.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// 展开图的包围盒是 8 x 6, 每个网格单元留出间隔
+static constexpr float s_cellWidth = 10.f;
+static constexpr float s_cellHeight = 8.f;
+static constexpr float s_foldPeriodSeconds = 4.f;
+
+MassScene::MassScene(uint32_t instanceCount, const std::vector<glm::vec3>& faceColors, uint32_t materialCount)
+{
+    // 固定种子, 离屏渲染的输出可以逐帧比对; 材质用单独的随机序列, 不影响颜色和动画
+    std::mt19937 random(1234);
+    std::mt19937 materialRandom(5678);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    std::uniform_int_distribution<uint32_t> material(0, std::clamp(materialCount, 1u, s_maxMaterials) - 1);
+
+    uint32_t columns = std::max(1u, static_cast<uint32_t>(std::ceil(std::sqrt(instanceCount * s_cellHeight / s_cellWidth))));
+    uint32_t rows = (instanceCount + columns - 1) / columns;
+    m_gridSize = glm::vec2(columns * s_cellWidth, rows * s_cellHeight);
+
+    m_instances.resize(instanceCount);
+    m_animations.resize(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; ++i) {
+        glm::vec2 center((i % columns + 0.5f) * s_cellWidth, (i / columns + 0.5f) * s_cellHeight);
+        m_instances[i].offset = glm::vec4(center - 0.5f * m_gridSize, 0.f, 0.f);
+        float tint = 0.6f + 0.4f * unit(random);
+        for (uint32_t face = 0; face < s_faceCount; ++face) {
+            m_instances[i].faceColors[face] = packColor(glm::vec4(faceColors[face] * tint, 1.f));
+        }
+        std::array<uint32_t, s_faceCount> faceMaterials{};
+        for (auto& faceMaterial : faceMaterials) {
+            faceMaterial = material(materialRandom);
+        }
+        m_instances[i].faceMaterials = packFaceMaterials(faceMaterials);
+
+        m_animations[i].phase = unit(random);
+        m_animations[i].period = s_foldPeriodSeconds * (0.75f + 0.5f * unit(random));
+        m_animations[i].maxAngle = glm::radians(90.f);
+    }
+}
+
+std::array<uint32_t, 2> MassScene::packFaceMaterials(const std::array<uint32_t, s_faceCount>& materials)
+{
+    std::array<uint32_t, 2> packed{};
+    for (uint32_t face = 0; face < s_faceCount; ++face) {
+        packed[face / 4] |= (materials[face] & 0xFFu) << (face % 4 * 8);
+    }
+    return packed;
+}
+
+glm::mat4 MassScene::fitTransform(float halfWidth, float halfHeight) const
+{
+    float fit = 0.95f * std::min(2.f * halfWidth / m_gridSize.x, 2.f * halfHeight / m_gridSize.y);
+    glm::mat4 m = glm::scale(glm::mat4(1.f), glm::vec3(fit));
+    return glm::rotate(m, glm::radians(-20.f), glm::vec3(1.f, 0.f, 0.f));
+}
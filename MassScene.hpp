@@ -0,0 +1,54 @@
+﻿#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// 与 shaders/mass_vert.glsl 和 shaders/cull.comp 中 std430 布局的 NetInstance 一致: 实例只有平移, 只存偏移;
+// 面的颜色打包成 RGBA8 (见 packColor), 面的材质号打包方式见 MassScene::packFaceMaterials
+struct NetInstance {
+    glm::vec4 offset{ 0.f };
+    std::array<uint32_t, 6> faceColors{};
+    std::array<uint32_t, 2> faceMaterials{};
+};
+static_assert(sizeof(NetInstance) == 48, "NetInstance must match the std430 layout in the shaders");
+
+// 与 shaders/fold.comp 中的 NetAnimation 一致: 折叠角度按 maxAngle * (1 - cos(2π(t / period + phase))) / 2 变化
+struct NetAnimation {
+    float phase = 0.f;
+    float period = 1.f;
+    float maxAngle = 0.f;
+    float padding = 0.f;
+};
+
+// 大场景模式: 成千上万个展开图实例共享同一份 24 顶点的几何, 各自以不同相位和周期反复折叠和展开;
+// 这里只生成实例的静态数据和动画参数, 每帧各个面的变换由计算着色器 fold.comp 求出
+class MassScene {
+public:
+    static const uint32_t s_faceCount = 6;
+    // 展开图在局部坐标中的包围球半径 (球心在原点), 展开和折叠的任何状态都在球内, 供 shaders/cull.comp 做视锥剔除
+    static constexpr float s_boundingRadius = 5.f;
+    // 材质号占 8 位
+    static constexpr uint32_t s_maxMaterials = 256;
+
+    // materialCount 大于 1 时每个面随机取一种材质, 否则都用材质 0, 其余随机数与不用材质时相同
+    MassScene(uint32_t instanceCount, const std::vector<glm::vec3>& faceColors, uint32_t materialCount);
+
+    // 6 个面的材质号各占 8 位, 按面号从低位排起, 着色器里用 bitfieldExtract 取出
+    static std::array<uint32_t, 2> packFaceMaterials(const std::array<uint32_t, s_faceCount>& materials);
+
+    uint32_t instanceCount() const noexcept { return static_cast<uint32_t>(m_instances.size()); }
+    const std::vector<NetInstance>& instances() const noexcept { return m_instances; }
+    const std::vector<NetAnimation>& animations() const noexcept { return m_animations; }
+
+    // 把整个网格缩放到 [-halfWidth, halfWidth] x [-halfHeight, halfHeight] 内, 并稍微倾斜以便看出折叠的深度
+    glm::mat4 fitTransform(float halfWidth, float halfHeight) const;
+
+private:
+    std::vector<NetInstance> m_instances;
+    std::vector<NetAnimation> m_animations;
+    glm::vec2 m_gridSize{ 0.f };
+};
@@ -0,0 +1,194 @@
+﻿#include "MeshCache.hpp"
+#include "Tracer.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char s_magic[8] = { 'V', 'C', 'M', 'E', 'S', 'H', '\0', '\0' };
+static_assert(sizeof(MeshCache::Header) == 112, "mesh cache header layout changed, bump MeshCache::s_version");
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        m_file = nullptr;
+        throw std::runtime_error("failed to open file for mapping!");
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(m_file, &size);
+    m_size = static_cast<size_t>(size.QuadPart);
+    if (m_size > 0) {
+        m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        m_data = m_mapping ? static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        if (m_data == nullptr) {
+            if (m_mapping) CloseHandle(m_mapping);
+            CloseHandle(m_file);
+            throw std::runtime_error("failed to map file!");
+        }
+    }
+#else
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+        throw std::runtime_error("failed to open file for mapping!");
+    }
+    struct stat status;
+    fstat(m_fd, &status);
+    m_size = static_cast<size_t>(status.st_size);
+    if (m_size > 0) {
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(m_fd);
+            throw std::runtime_error("failed to map file!");
+        }
+        // 整个文件都会被顺序读一遍 (哈希或上传)
+        madvise(data, m_size, MADV_SEQUENTIAL);
+        madvise(data, m_size, MADV_WILLNEED);
+        m_data = static_cast<const uint8_t*>(data);
+    }
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file) CloseHandle(m_file);
+#else
+    if (m_data) munmap(const_cast<uint8_t*>(m_data), m_size);
+    if (m_fd >= 0) ::close(m_fd);
+#endif
+}
+
+uint64_t MeshCache::hashFile(const std::filesystem::path& path)
+{
+    TRACE_FUNCTION("assets");
+    MappedFile file(path);
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < file.size(); ++i) {
+        hash = (hash ^ file.data()[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+std::filesystem::path MeshCache::cachePath(const std::filesystem::path& directory, uint64_t sourceHash)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.mesh", static_cast<unsigned long long>(sourceHash));
+    return directory / name;
+}
+
+std::unique_ptr<MeshCache> MeshCache::open(const std::filesystem::path& path, uint64_t sourceHash)
+{
+    TRACE_FUNCTION("assets");
+    std::error_code error;
+    if (!std::filesystem::exists(path, error)) return nullptr;
+
+    // 缓存只是加速, 文件存在但打不开或映射失败时也重新导入
+    std::unique_ptr<MeshCache> cache;
+    try {
+        cache.reset(new MeshCache(path));
+    }
+    catch (const std::exception& e) {
+        spdlog::warn("Ignoring unreadable mesh cache {}: {}", path.string(), e.what());
+        return nullptr;
+    }
+    size_t size = cache->m_file.size();
+    if (size < sizeof(Header)) return nullptr;
+
+    const Header* header = reinterpret_cast<const Header*>(cache->m_file.data());
+    // 偏移和大小来自文件, 先比较偏移再比较剩余长度, 避免相加溢出
+    auto inFile = [size](uint64_t offset, uint64_t length) { return offset <= size && length <= size - offset; };
+    bool indexTypeValid = header->indexType == VK_INDEX_TYPE_UINT16 || header->indexType == VK_INDEX_TYPE_UINT32;
+    // 空的缓冲区不能创建, 跨度必须与顶点格式一致
+    bool countsValid = header->vertexCount > 0 && header->indexCount > 0
+        && header->vertexStride == vertexFormatSize(static_cast<VkFormat>(header->vertexFormat));
+    bool valid = memcmp(header->magic, s_magic, sizeof(s_magic)) == 0 && header->version == s_version && header->sourceHash == sourceHash
+        && header->vertexOffset % s_blobAlignment == 0 && header->indexOffset % s_blobAlignment == 0 && indexTypeValid && countsValid
+        && header->vertexSize == static_cast<uint64_t>(header->vertexStride) * header->vertexCount
+        && header->indexSize == static_cast<uint64_t>(header->indexCount) * (header->indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4)
+        && inFile(header->vertexOffset, header->vertexSize) && inFile(header->indexOffset, header->indexSize);
+    // 索引越界会让顶点读取越界, 逐个检查
+    if (valid) {
+        const uint8_t* indices = cache->m_file.data() + header->indexOffset;
+        for (uint32_t i = 0; i < header->indexCount && valid; ++i) {
+            uint32_t index;
+            if (header->indexType == VK_INDEX_TYPE_UINT16) {
+                uint16_t index16;
+                memcpy(&index16, indices + i * sizeof(uint16_t), sizeof(index16));
+                index = index16;
+            }
+            else {
+                memcpy(&index, indices + i * sizeof(uint32_t), sizeof(index));
+            }
+            valid = index < header->vertexCount;
+        }
+    }
+    if (!valid) {
+        spdlog::warn("Ignoring stale or damaged mesh cache {}", path.string());
+        return nullptr;
+    }
+    cache->m_header = header;
+    return cache;
+}
+
+void MeshCache::write(const std::filesystem::path& path, uint64_t sourceHash, const PackedPositions& positions, const PackedIndices& indices, float extent)
+{
+    TRACE_FUNCTION("assets");
+    auto align = [](uint64_t offset) { return (offset + s_blobAlignment - 1) / s_blobAlignment * s_blobAlignment; };
+
+    Header header{};
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = s_version;
+    header.vertexFormat = static_cast<uint32_t>(positions.format);
+    header.sourceHash = sourceHash;
+    header.vertexStride = positions.stride;
+    header.vertexCount = static_cast<uint32_t>(positions.data.size() / positions.stride);
+    header.indexType = static_cast<uint32_t>(indices.type);
+    header.indexCount = indices.count;
+    header.extent = extent;
+    for (int i = 0; i < 4; ++i) {
+        header.positionScale[i] = positions.scale[i];
+        header.positionOffset[i] = positions.offset[i];
+    }
+    header.vertexOffset = align(sizeof(Header));
+    header.vertexSize = positions.data.size();
+    header.indexOffset = align(header.vertexOffset + header.vertexSize);
+    header.indexSize = indices.data.size();
+
+    std::filesystem::create_directories(path.parent_path());
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to create mesh cache file!");
+        }
+        std::vector<char> padding(s_blobAlignment, 0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(padding.data(), header.vertexOffset - sizeof(header));
+        file.write(reinterpret_cast<const char*>(positions.data.data()), header.vertexSize);
+        file.write(padding.data(), header.indexOffset - header.vertexOffset - header.vertexSize);
+        file.write(reinterpret_cast<const char*>(indices.data.data()), header.indexSize);
+        if (!file) {
+            throw std::runtime_error("failed to write mesh cache file!");
+        }
+    }
+    std::filesystem::rename(temporaryPath, path);
+    spdlog::info("Wrote mesh cache {} ({:.2f} MB)", path.string(), (header.indexOffset + header.indexSize) / (1024.0 * 1024.0));
+}
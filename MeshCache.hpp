@@ -0,0 +1,80 @@
+﻿#pragma once
+#include "VertexPacking.hpp"
+#include "MeshImport.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+// 只读映射整个文件; 打开或映射失败时抛出异常
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    const uint8_t* data() const noexcept { return m_data; }
+    size_t size() const noexcept { return m_size; }
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
+
+// 二进制网格缓存: 固定大小的文件头之后是按 s_blobAlignment 对齐的顶点和索引数据, 都是打包好的 GPU 格式,
+// 映射之后不需要解析就交给上传 (显存对 CPU 可见时从映射直接复制到缓冲区, 否则和其他上传一样经过暂存复制); 文件名和文件头都带源文件内容的哈希, 源文件改变后自动失效.
+// 按本机字节序写入, 不跨平台共享
+class MeshCache {
+public:
+    // 2: 导入的网格按多边形分面, 旧缓存中面交界处的顶点分错了面
+    // 3: 增加量化顶点格式的还原参数
+    static const uint32_t s_version = 3;
+    static const uint32_t s_blobAlignment = 64;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t vertexFormat;  // VkFormat
+        uint64_t sourceHash;
+        uint32_t vertexStride;
+        uint32_t vertexCount;
+        uint32_t indexType;     // VkIndexType
+        uint32_t indexCount;
+        // 顶点到原点的最大距离, 用于放大包围球
+        float extent;
+        uint32_t padding;
+        uint64_t vertexOffset;
+        uint64_t vertexSize;
+        uint64_t indexOffset;
+        uint64_t indexSize;
+        // PackedPositions::scale 和 offset
+        float positionScale[4];
+        float positionOffset[4];
+    };
+
+    // 源文件内容的 64 位 FNV-1a 哈希
+    static uint64_t hashFile(const std::filesystem::path& path);
+    static std::filesystem::path cachePath(const std::filesystem::path& directory, uint64_t sourceHash);
+
+    // 缓存不存在、打不开或映射失败、版本或哈希不匹配、数据越界时返回 nullptr, 调用方重新导入
+    static std::unique_ptr<MeshCache> open(const std::filesystem::path& path, uint64_t sourceHash);
+    // 先写临时文件再重命名, 中途失败不会留下不完整的缓存
+    static void write(const std::filesystem::path& path, uint64_t sourceHash, const PackedPositions& positions, const PackedIndices& indices, float extent);
+
+    const Header& header() const noexcept { return *m_header; }
+    const uint8_t* vertexData() const noexcept { return m_file.data() + m_header->vertexOffset; }
+    const uint8_t* indexData() const noexcept { return m_file.data() + m_header->indexOffset; }
+
+private:
+    explicit MeshCache(const std::filesystem::path& path) : m_file(path) {}
+
+    MappedFile m_file;
+    const Header* m_header = nullptr;
+};
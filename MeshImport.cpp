@@ -0,0 +1,352 @@
+﻿#include "MeshImport.hpp"
+#include "Tracer.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace {
+    // 按位哈希; 去重前把 -0 规范成 +0, 让按 == 相等的顶点哈希也相同
+    struct MeshVertexHash {
+        size_t operator()(const MeshVertex& vertex) const noexcept {
+            uint64_t hash = 0x9E3779B97F4A7C15ull * (vertex.face + 1);
+            for (int i = 0; i < 3; ++i) {
+                uint32_t bits;
+                memcpy(&bits, &vertex.position[i], sizeof(bits));
+                hash = (hash ^ bits) * 0xFF51AFD7ED558CCDull;
+                hash ^= hash >> 32;
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    // Forsyth 的评分函数
+    const float s_cacheDecayPower = 1.5f;
+    const float s_lastTriangleScore = 0.75f;
+    const float s_valenceBoostScale = 2.f;
+    const float s_valenceBoostPower = 0.5f;
+
+    float vertexScore(int32_t cachePosition, uint32_t remainingTriangles)
+    {
+        if (remainingTriangles == 0) return -1.f;
+
+        float score = 0.f;
+        if (cachePosition >= 0) {
+            // 刚用过的三个顶点属于上一个三角形, 给固定分数, 避免总是选相邻的三角形形成长条
+            if (cachePosition < 3) {
+                score = s_lastTriangleScore;
+            }
+            else {
+                float scaler = 1.f / (MeshImport::s_cacheSize - 3);
+                score = std::pow(1.f - (cachePosition - 3) * scaler, s_cacheDecayPower);
+            }
+        }
+        // 剩余三角形少的顶点优先, 尽早把它们用完
+        score += s_valenceBoostScale * std::pow(static_cast<float>(remainingTriangles), -s_valenceBoostPower);
+        return score;
+    }
+
+    int64_t parseObjIndex(const std::string& token, size_t count)
+    {
+        // v, v/vt, v//vn, v/vt/vn 只取位置; 负数表示从末尾倒数, 0 和超出已读顶点数的下标无效
+        std::string position = token.substr(0, token.find('/'));
+        int64_t index = 0;
+        size_t parsed = 0;
+        try {
+            index = std::stoll(position, &parsed);
+        }
+        catch (const std::exception&) {
+            parsed = 0;
+        }
+        if (parsed == 0 || parsed != position.size()) {
+            throw std::runtime_error("failed to parse mesh file: invalid vertex index!");
+        }
+        index = index < 0 ? static_cast<int64_t>(count) + index : index - 1;
+        if (index < 0 || index >= static_cast<int64_t>(count)) {
+            throw std::runtime_error("failed to parse mesh file: invalid vertex index!");
+        }
+        return index;
+    }
+}
+
+Mesh MeshImport::loadObj(const std::filesystem::path& path, const std::function<uint32_t(const glm::vec3&)>& faceOf)
+{
+    TRACE_FUNCTION("assets");
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open mesh file!");
+    }
+
+    std::vector<glm::vec3> positions;
+    std::vector<MeshVertex> triangleVertices;
+    std::string line;
+    std::vector<int64_t> polygon;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+        if (keyword == "v") {
+            glm::vec3 position;
+            stream >> position.x >> position.y >> position.z;
+            positions.push_back(position);
+        }
+        else if (keyword == "f") {
+            polygon.clear();
+            std::string token;
+            while (stream >> token) {
+                polygon.push_back(parseObjIndex(token, positions.size()));
+            }
+            // 整个多边形按重心归入一个面; 面交界处共享的位置在每个面各有一份顶点, 去重时不会合并
+            glm::vec3 centroid(0.f);
+            for (int64_t index : polygon) {
+                centroid += positions[static_cast<size_t>(index)];
+            }
+            uint32_t face = polygon.empty() ? 0 : faceOf(centroid / static_cast<float>(polygon.size()));
+            for (size_t i = 2; i < polygon.size(); ++i) {
+                for (int64_t index : { polygon[0], polygon[i - 1], polygon[i] }) {
+                    triangleVertices.push_back(MeshVertex{ positions[static_cast<size_t>(index)], face });
+                }
+            }
+        }
+    }
+    if (triangleVertices.empty()) {
+        throw std::runtime_error("mesh file contains no faces!");
+    }
+
+    Mesh mesh = deduplicate(triangleVertices);
+    float missRatio = averageCacheMissRatio(mesh);
+    optimize(mesh);
+    spdlog::info("Imported {}: {} triangles, {} of {} vertices unique, ACMR {:.3f} -> {:.3f}", path.string(), mesh.indices.size() / 3,
+        mesh.vertices.size(), triangleVertices.size(), missRatio, averageCacheMissRatio(mesh));
+    return mesh;
+}
+
+Mesh MeshImport::deduplicate(const std::vector<MeshVertex>& triangleVertices)
+{
+    Mesh mesh;
+    std::unordered_map<MeshVertex, uint32_t, MeshVertexHash> uniqueVertices;
+    uniqueVertices.reserve(triangleVertices.size());
+    mesh.indices.reserve(triangleVertices.size());
+    for (MeshVertex vertex : triangleVertices) {
+        vertex.position += glm::vec3(0.f);
+        auto [it, inserted] = uniqueVertices.try_emplace(vertex, static_cast<uint32_t>(mesh.vertices.size()));
+        if (inserted) {
+            mesh.vertices.push_back(vertex);
+        }
+        mesh.indices.push_back(it->second);
+    }
+    return mesh;
+}
+
+void MeshImport::optimizeVertexCache(Mesh& mesh)
+{
+    size_t vertexCount = mesh.vertices.size();
+    size_t triangleCount = mesh.indices.size() / 3;
+    if (triangleCount == 0) return;
+
+    // 每个顶点的邻接三角形列表, 平铺在一个数组里; 三角形输出后从列表中移除
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (uint32_t index : mesh.indices) {
+        ++remaining[index];
+    }
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    std::partial_sum(remaining.begin(), remaining.end(), adjacencyOffsets.begin() + 1);
+    std::vector<uint32_t> adjacency(mesh.indices.size());
+    std::vector<uint32_t> filled(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+        adjacency[filled[mesh.indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    std::vector<int32_t> cachePositions(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertexScores[v] = vertexScore(-1, remaining[v]);
+    }
+    std::vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        triangleScores[t] = vertexScores[mesh.indices[t * 3]] + vertexScores[mesh.indices[t * 3 + 1]] + vertexScores[mesh.indices[t * 3 + 2]];
+    }
+    std::vector<bool> emitted(triangleCount, false);
+
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> newCache;
+    std::vector<uint32_t> output;
+    output.reserve(mesh.indices.size());
+    size_t nextUnemitted = 0;
+    int64_t best = std::max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin();
+
+    while (output.size() < mesh.indices.size()) {
+        if (best < 0) {
+            // 缓存中的顶点都没有剩余的三角形, 从还没输出的三角形中按顺序取一个重新开始
+            while (emitted[nextUnemitted]) {
+                ++nextUnemitted;
+            }
+            best = static_cast<int64_t>(nextUnemitted);
+        }
+
+        const uint32_t* triangle = &mesh.indices[static_cast<size_t>(best) * 3];
+        output.insert(output.end(), triangle, triangle + 3);
+        emitted[static_cast<size_t>(best)] = true;
+
+        newCache.clear();
+        for (int i = 0; i < 3; ++i) {
+            uint32_t v = triangle[i];
+            uint32_t* begin = &adjacency[adjacencyOffsets[v]];
+            uint32_t* end = begin + remaining[v];
+            *std::find(begin, end, static_cast<uint32_t>(best)) = *(end - 1);
+            --remaining[v];
+            // 退化三角形可能重复引用同一个顶点
+            if (std::find(newCache.begin(), newCache.end(), v) == newCache.end()) {
+                newCache.push_back(v);
+            }
+        }
+        for (uint32_t v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                newCache.push_back(v);
+            }
+        }
+
+        // 挤出缓存的顶点和仍在缓存中的顶点都要重新评分, 再更新它们的邻接三角形
+        best = -1;
+        float bestScore = -1.f;
+        for (size_t position = 0; position < newCache.size(); ++position) {
+            uint32_t v = newCache[position];
+            cachePositions[v] = position < s_cacheSize ? static_cast<int32_t>(position) : -1;
+            float score = vertexScore(cachePositions[v], remaining[v]);
+            float delta = score - vertexScores[v];
+            vertexScores[v] = score;
+            for (uint32_t i = 0; i < remaining[v]; ++i) {
+                uint32_t t = adjacency[adjacencyOffsets[v] + i];
+                triangleScores[t] += delta;
+                if (position < s_cacheSize && triangleScores[t] > bestScore) {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+        }
+        if (newCache.size() > s_cacheSize) {
+            newCache.resize(s_cacheSize);
+        }
+        cache.swap(newCache);
+    }
+    mesh.indices.swap(output);
+}
+
+void MeshImport::optimizeOverdraw(Mesh& mesh)
+{
+    size_t triangleCount = mesh.indices.size() / 3;
+    size_t clusterCount = (triangleCount + s_clusterTriangles - 1) / s_clusterTriangles;
+    if (clusterCount < 2) return;
+
+    glm::vec3 meshCenter(0.f);
+    for (const auto& vertex : mesh.vertices) {
+        meshCenter += vertex.position;
+    }
+    meshCenter /= static_cast<float>(mesh.vertices.size());
+
+    // 簇的面积加权法线和中心; 中心相对网格中心越朝法线方向, 越可能是外表面, 越先画
+    std::vector<float> sortKeys(clusterCount);
+    for (size_t cluster = 0; cluster < clusterCount; ++cluster) {
+        glm::vec3 normal(0.f);
+        glm::vec3 center(0.f);
+        float area = 0.f;
+        size_t end = std::min(triangleCount, (cluster + 1) * s_clusterTriangles);
+        for (size_t t = cluster * s_clusterTriangles; t < end; ++t) {
+            const glm::vec3& a = mesh.vertices[mesh.indices[t * 3]].position;
+            const glm::vec3& b = mesh.vertices[mesh.indices[t * 3 + 1]].position;
+            const glm::vec3& c = mesh.vertices[mesh.indices[t * 3 + 2]].position;
+            glm::vec3 weighted = glm::cross(b - a, c - a);
+            float triangleArea = glm::length(weighted);
+            normal += weighted;
+            center += (a + b + c) * (triangleArea / 3.f);
+            area += triangleArea;
+        }
+        if (area > 0.f) {
+            center /= area;
+        }
+        float length = glm::length(normal);
+        sortKeys[cluster] = length > 0.f ? glm::dot(center - meshCenter, normal / length) : 0.f;
+    }
+
+    std::vector<uint32_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(mesh.indices.size());
+    for (uint32_t cluster : order) {
+        size_t begin = cluster * s_clusterTriangles * 3;
+        size_t end = std::min(mesh.indices.size(), begin + s_clusterTriangles * 3);
+        output.insert(output.end(), mesh.indices.begin() + begin, mesh.indices.begin() + end);
+    }
+    mesh.indices.swap(output);
+}
+
+void MeshImport::optimizeVertexFetch(Mesh& mesh)
+{
+    const uint32_t unused = UINT32_MAX;
+    std::vector<uint32_t> remap(mesh.vertices.size(), unused);
+    std::vector<MeshVertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+    for (uint32_t& index : mesh.indices) {
+        if (remap[index] == unused) {
+            remap[index] = static_cast<uint32_t>(vertices.size());
+            vertices.push_back(mesh.vertices[index]);
+        }
+        index = remap[index];
+    }
+    // 没有被任何三角形引用的顶点直接丢弃
+    mesh.vertices.swap(vertices);
+}
+
+void MeshImport::optimize(Mesh& mesh)
+{
+    TRACE_FUNCTION("assets");
+    optimizeVertexCache(mesh);
+    optimizeOverdraw(mesh);
+    optimizeVertexFetch(mesh);
+}
+
+float MeshImport::averageCacheMissRatio(const Mesh& mesh)
+{
+    if (mesh.indices.empty()) return 0.f;
+
+    std::vector<uint64_t> insertedAt(mesh.vertices.size(), 0);
+    uint64_t misses = 0;
+    for (uint32_t index : mesh.indices) {
+        // insertedAt 从 1 开始计数, 0 表示从未进入缓存
+        if (insertedAt[index] == 0 || misses - insertedAt[index] + 1 > s_cacheSize) {
+            ++misses;
+            insertedAt[index] = misses;
+        }
+    }
+    return static_cast<float>(misses) / static_cast<float>(mesh.indices.size() / 3);
+}
+
+PackedIndices MeshImport::packIndices(const Mesh& mesh)
+{
+    PackedIndices packed;
+    packed.count = static_cast<uint32_t>(mesh.indices.size());
+    if (mesh.vertices.size() <= 65536) {
+        packed.type = VK_INDEX_TYPE_UINT16;
+        packed.data.resize(mesh.indices.size() * sizeof(uint16_t));
+        uint16_t* indices = reinterpret_cast<uint16_t*>(packed.data.data());
+        for (size_t i = 0; i < mesh.indices.size(); ++i) {
+            indices[i] = static_cast<uint16_t>(mesh.indices[i]);
+        }
+    }
+    else {
+        packed.type = VK_INDEX_TYPE_UINT32;
+        packed.data.resize(mesh.indices.size() * sizeof(uint32_t));
+        memcpy(packed.data.data(), mesh.indices.data(), packed.data.size());
+    }
+    return packed;
+}
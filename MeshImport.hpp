@@ -0,0 +1,61 @@
+﻿#pragma once
+#include <vulkan/vulkan.h>
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+// face 是顶点所属的展开图的面, 折叠时顶点跟随这个面的变换
+struct MeshVertex {
+    glm::vec3 position{ 0.f };
+    uint32_t face = 0;
+
+    bool operator==(const MeshVertex& other) const noexcept { return position == other.position && face == other.face; }
+};
+
+struct Mesh {
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+};
+
+// 按顶点数选择的索引格式, data 可以直接上传到索引缓冲区
+struct PackedIndices {
+    VkIndexType type = VK_INDEX_TYPE_UINT16;
+    uint32_t count = 0;
+    std::vector<uint8_t> data;
+};
+
+// 网格导入: 三角形列表先去重成索引网格, 再依次做顶点缓存优化、过度绘制优化和顶点读取优化;
+// 各步骤单独公开, 以便程序生成的网格也走同一条路径
+namespace MeshImport {
+    // post-transform 顶点缓存的模拟大小, 与常见 GPU 的实际大小量级相当
+    constexpr uint32_t s_cacheSize = 32;
+    // 过度绘制优化时每个簇的三角形数, 越大越保留缓存局部性, 越小越能按朝向排序
+    constexpr uint32_t s_clusterTriangles = 64;
+
+    // 读取 OBJ 中的 v 和 f (多边形按扇形三角化), 其余内容忽略; faceOf 按多边形的重心给出它所属的面, 多边形的所有顶点都归入这个面
+    Mesh loadObj(const std::filesystem::path& path, const std::function<uint32_t(const glm::vec3&)>& faceOf);
+
+    // 三角形列表 (每 3 个顶点一个三角形) 转成索引网格, 完全相同的顶点只保留一份
+    Mesh deduplicate(const std::vector<MeshVertex>& triangleVertices);
+
+    // Forsyth 的线性时间算法: 贪心地选择与缓存中顶点共享最多、剩余邻接三角形最少的三角形
+    void optimizeVertexCache(Mesh& mesh);
+    // 按簇的朝向重排, 先画朝外的簇, 让被遮挡的片元更早被深度测试剔除; 簇内顺序不变
+    void optimizeOverdraw(Mesh& mesh);
+    // 顶点按第一次被索引的顺序重排, 顶点读取尽量顺序访问
+    void optimizeVertexFetch(Mesh& mesh);
+
+    // 依次执行以上三个优化
+    void optimize(Mesh& mesh);
+
+    // 模拟 FIFO 顶点缓存, 返回平均每个三角形的缓存未命中数 (ACMR), 用于评估优化效果
+    float averageCacheMissRatio(const Mesh& mesh);
+
+    // 顶点数不超过 65536 时用 16 位索引
+    PackedIndices packIndices(const Mesh& mesh);
+}
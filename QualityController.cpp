@@ -0,0 +1,67 @@
+﻿#include "QualityController.hpp"
+
+#include <algorithm>
+
+// 切换后先观察若干帧再做决定, 避免用旧等级的数据评价新等级
+static constexpr uint32_t s_settleFrames = 30;
+static constexpr uint32_t s_upgradeFrames = 180;
+static constexpr uint32_t s_maxBackoffShift = 4;
+static constexpr double s_downgradeThreshold = 0.95;
+static constexpr double s_upgradeThreshold = 0.6;
+
+QualityController::QualityController(uint32_t maxSamples, bool allowScaling, double targetFrameTimeMS)
+    : m_targetMS(targetFrameTimeMS)
+{
+    // 先逐级减少采样数, 降到单采样后再降低内部分辨率
+    for (uint32_t samples = std::max(maxSamples, 1u); samples >= 1; samples /= 2) {
+        m_levels.push_back({ samples, 1.0f });
+    }
+    if (allowScaling) {
+        for (float scale : { 0.85f, 0.75f, 0.67f, 0.5f }) {
+            m_levels.push_back({ 1, scale });
+        }
+    }
+    m_failures.assign(m_levels.size(), 0);
+}
+
+bool QualityController::onGpuFrameTime(double ms)
+{
+    if (m_waitingForApply) return false;
+
+    m_averageMS = m_averageMS == 0.0 ? ms : m_averageMS * 0.9 + ms * 0.1;
+    if (++m_framesAtLevel < s_settleFrames) return false;
+
+    size_t next = m_index;
+    if (m_averageMS > m_targetMS * s_downgradeThreshold) {
+        m_headroomFrames = 0;
+        if (m_index + 1 < m_levels.size()) {
+            ++m_failures[m_index];
+            next = m_index + 1;
+        }
+    }
+    else if (m_index > 0 && m_averageMS < m_targetMS * s_upgradeThreshold) {
+        uint32_t required = s_upgradeFrames << std::min(m_failures[m_index - 1], s_maxBackoffShift);
+        if (++m_headroomFrames >= required) {
+            next = m_index - 1;
+        }
+    }
+    else {
+        m_headroomFrames = 0;
+    }
+
+    if (next == m_index) return false;
+
+    m_index = next;
+    m_framesAtLevel = 0;
+    m_headroomFrames = 0;
+    m_averageMS = 0.0;
+    m_waitingForApply = true;
+    return true;
+}
+
+void QualityController::onLevelApplied()
+{
+    m_waitingForApply = false;
+    m_framesAtLevel = 0;
+    m_averageMS = 0.0;
+}
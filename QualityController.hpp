@@ -0,0 +1,37 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 根据测得的 GPU 帧时间沿一条画质阶梯调节 MSAA 采样数和内部渲染比例, 使帧时间保持在目标以内
+class QualityController {
+public:
+    struct Level {
+        uint32_t samples = 1;
+        float scale = 1.0f;
+    };
+
+    QualityController(uint32_t maxSamples, bool allowScaling, double targetFrameTimeMS);
+
+    const Level& current() const noexcept { return m_levels[m_index]; }
+    size_t levelCount() const noexcept { return m_levels.size(); }
+    double targetFrameTimeMS() const noexcept { return m_targetMS; }
+    double averageFrameTimeMS() const noexcept { return m_averageMS; }
+
+    // 每帧输入一次 GPU 时间; 需要切换等级时返回 true, 新等级由 current() 给出
+    bool onGpuFrameTime(double ms);
+
+    // 新等级的资源在后台重建, 生效之前不再做新的决定
+    void onLevelApplied();
+
+private:
+    std::vector<Level> m_levels;
+    size_t m_index = 0;
+    double m_targetMS;
+    double m_averageMS = 0.0;
+    uint32_t m_framesAtLevel = 0;
+    uint32_t m_headroomFrames = 0;
+    bool m_waitingForApply = false;
+    // 每个等级因超时被降下来的次数, 再次升回去需要的富余帧数随之翻倍
+    std::vector<uint32_t> m_failures;
+};
@@ -1,4 +1,5 @@
 ﻿#include "ShaderCompiler.hpp"
+#include "Tracer.hpp"
 
 #include <spdlog/spdlog.h>
 #include <fstream>
@@ -62,8 +63,10 @@ EShLanguage ShaderCompiler::getShaderStage(const std::string& filename) {
 
 std::vector<uint32_t> ShaderCompiler::compileGLSL(const std::filesystem::path& file, EShLanguage stage) const
 {
+    TRACE_SCOPE("shader", Tracer::getInstance().enabled() ? Tracer::getInstance().intern(file.filename().string()) : "compileGLSL");
     std::string saveFile = file.string() + ".spv";
-    if (std::filesystem::exists(saveFile)) {
+    // 源文件比缓存新时重新编译, 修改着色器后不必手动删除 .spv
+    if (std::filesystem::exists(saveFile) && std::filesystem::last_write_time(saveFile) >= std::filesystem::last_write_time(file)) {
         spdlog::debug("{} already compiled to {}", file.string(), saveFile);
         return readSPVFile(saveFile);
     }
@@ -111,6 +114,7 @@ std::vector<uint32_t> ShaderCompiler::compileGLSL(const std::filesystem::path& f
 
 std::vector<uint32_t> ShaderCompiler::compileGLSL(const std::string& source, EShLanguage stage) const
 {
+    TRACE_FUNCTION("shader");
     spdlog::debug("Compiling GLSL: {}", source);
     const char* sourceCStr = source.c_str();
 
@@ -118,7 +122,8 @@ std::vector<uint32_t> ShaderCompiler::compileGLSL(const std::string& source, ESh
     shader.setStrings(&sourceCStr, 1);
 
     glslang::EShTargetClientVersion vulkanClientVersion = glslang::EShTargetVulkan_1_3;
-    glslang::EShTargetLanguageVersion targetVersion = glslang::EShTargetSpv_1_5;
+    // 与文件版本一致: 实例只要求 Vulkan 1.1, 不能生成更高版本的 SPIR-V
+    glslang::EShTargetLanguageVersion targetVersion = glslang::EShTargetSpv_1_0;
 
     shader.setEnvInput(glslang::EShSourceGlsl, stage, glslang::EShClientVulkan, m_vulkanAPIVersion);
     shader.setEnvClient(glslang::EShClientVulkan, vulkanClientVersion);
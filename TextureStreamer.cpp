@@ -0,0 +1,240 @@
+﻿#include "TextureStreamer.hpp"
+#include "Tracer.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static const uint8_t s_ktx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const uint8_t s_white[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+
+// KTX2 文件头和索引, 之后紧跟每个层级 24 字节的层级索引
+struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+struct Ktx2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header is 80 bytes");
+static_assert(sizeof(Ktx2LevelIndex) == 24, "KTX2 level index entries are 24 bytes");
+
+TextureStreamer::BlockInfo TextureStreamer::blockInfo(VkFormat format)
+{
+    switch (format) {
+    case VK_FORMAT_R8_UNORM:
+        return { 1, 1, 1 };
+    case VK_FORMAT_R8G8_UNORM:
+        return { 1, 1, 2 };
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+        return { 1, 1, 4 };
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+        return { 1, 1, 8 };
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        return { 1, 1, 16 };
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+        return { 4, 4, 8 };
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        return { 4, 4, 16 };
+    default:
+        throw std::runtime_error("unsupported texture format!");
+    }
+}
+
+TextureSource TextureStreamer::loadKtx2(const std::filesystem::path& path)
+{
+    TRACE_FUNCTION("assets");
+    TextureSource source;
+    source.file = std::make_unique<MappedFile>(path);
+    const uint8_t* data = source.file->data();
+    size_t size = source.file->size();
+
+    Ktx2Header header;
+    if (size < sizeof(header)) {
+        throw std::runtime_error("failed to read KTX2 header!");
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.identifier, s_ktx2Identifier, sizeof(s_ktx2Identifier)) != 0) {
+        throw std::runtime_error("not a KTX2 file!");
+    }
+    // 超压缩 (Basis、Zstandard) 需要转码, 数组、立方体和三维纹理不用于表面
+    if (header.vkFormat == VK_FORMAT_UNDEFINED || header.supercompressionScheme != 0 || header.pixelHeight == 0 || header.pixelDepth != 0
+        || header.layerCount > 1 || header.faceCount != 1) {
+        throw std::runtime_error("unsupported KTX2 texture layout!");
+    }
+
+    source.format = static_cast<VkFormat>(header.vkFormat);
+    BlockInfo block = blockInfo(source.format);
+    // levelCount 为 0 表示要求加载方生成 mip 链, 这里不生成, 只用基础层级
+    uint32_t levelCount = std::max(header.levelCount, 1u);
+    if (size < sizeof(header) + sizeof(Ktx2LevelIndex) * levelCount) {
+        throw std::runtime_error("failed to read KTX2 level index!");
+    }
+    for (uint32_t level = 0; level < levelCount; ++level) {
+        Ktx2LevelIndex index;
+        memcpy(&index, data + sizeof(header) + sizeof(Ktx2LevelIndex) * level, sizeof(index));
+
+        TextureLevel textureLevel;
+        textureLevel.extent = { std::max(header.pixelWidth >> level, 1u), std::max(header.pixelHeight >> level, 1u), 1 };
+        uint64_t blocksWide = (textureLevel.extent.width + block.width - 1) / block.width;
+        uint64_t blocksHigh = (textureLevel.extent.height + block.height - 1) / block.height;
+        if (index.byteLength != blocksWide * blocksHigh * block.bytes || index.byteOffset > size || index.byteLength > size - index.byteOffset) {
+            throw std::runtime_error("corrupt KTX2 level data!");
+        }
+        textureLevel.data = data + index.byteOffset;
+        textureLevel.size = index.byteLength;
+        source.levels.push_back(textureLevel);
+    }
+    spdlog::info("Loaded texture {}: {}x{}, {} mip levels", path.string(), header.pixelWidth, header.pixelHeight, levelCount);
+    return source;
+}
+
+TextureSource TextureStreamer::whiteTexture()
+{
+    TextureSource source;
+    source.format = VK_FORMAT_R8G8B8A8_UNORM;
+    source.levels.push_back({ { 1, 1, 1 }, s_white, sizeof(s_white) });
+    return source;
+}
+
+TextureStreamer::TextureStreamer(VkDevice device, VmaAllocator allocator, const std::vector<uint32_t>& queueFamilies, TextureSource source)
+    : m_device(device), m_allocator(allocator), m_source(std::move(source)), m_block(blockInfo(m_source.format))
+{
+    const VkExtent3D& extent = m_source.levels[0].extent;
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = extent;
+    imageInfo.mipLevels = levelCount();
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = m_source.format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (queueFamilies.size() > 1) {
+        imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+        imageInfo.pQueueFamilyIndices = queueFamilies.data();
+    }
+
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    if (vmaCreateImage(m_allocator, &imageInfo, &allocCreateInfo, &m_image, &m_allocation, nullptr) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture image!");
+    }
+
+    m_residentLevel = levelCount();
+    m_nextLevel = static_cast<int32_t>(levelCount()) - 1;
+    m_levelSerials.assign(levelCount(), UINT64_MAX);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    vmaDestroyImage(m_allocator, m_image, m_allocation);
+}
+
+void TextureStreamer::uploadInitial(TransferQueue& transferQueue, VkDeviceSize budget)
+{
+    VkDeviceSize total = 0;
+    while (m_nextLevel >= 0) {
+        const TextureLevel& level = m_source.levels[m_nextLevel];
+        if (total > 0 && total + level.size > budget) break;
+
+        TransferQueue::ImageRegion region;
+        region.image = m_image;
+        region.mipLevel = static_cast<uint32_t>(m_nextLevel);
+        region.extent = level.extent;
+        transferQueue.enqueueImage(region, level.data, level.size);
+        total += level.size;
+        m_levelSerials[m_nextLevel] = 0;
+        m_residentLevel = static_cast<uint32_t>(m_nextLevel);
+        --m_nextLevel;
+    }
+    spdlog::debug("Uploading texture levels {}..{} with the first frame ({} bytes)", m_residentLevel, levelCount() - 1, total);
+}
+
+VkDeviceSize TextureStreamer::stream(TransferQueue& transferQueue, VkDeviceSize budget)
+{
+    if (m_nextLevel < 0 || m_pendingSerial > transferQueue.completedSerial() || !transferQueue.empty()) return 0;
+
+    TRACE_FUNCTION("transfer");
+    std::vector<uint32_t> finishedLevels;
+    VkDeviceSize total = 0;
+    while (m_nextLevel >= 0 && total < budget) {
+        const TextureLevel& level = m_source.levels[m_nextLevel];
+        uint32_t blockRows = (level.extent.height + m_block.height - 1) / m_block.height;
+        VkDeviceSize rowBytes = level.size / blockRows;
+        if (total > 0 && rowBytes > budget - total) break;
+        uint32_t rows = static_cast<uint32_t>(std::clamp<VkDeviceSize>((budget - total) / rowBytes, 1, blockRows - m_nextRow));
+
+        TransferQueue::ImageRegion region;
+        region.image = m_image;
+        region.mipLevel = static_cast<uint32_t>(m_nextLevel);
+        region.offset = { 0, static_cast<int32_t>(m_nextRow * m_block.height), 0 };
+        region.extent = { level.extent.width, std::min(rows * m_block.height, level.extent.height - m_nextRow * m_block.height), 1 };
+        region.firstOfLevel = m_nextRow == 0;
+        region.lastOfLevel = m_nextRow + rows == blockRows;
+        transferQueue.enqueueImage(region, level.data + m_nextRow * rowBytes, rows * rowBytes);
+        total += rows * rowBytes;
+
+        m_nextRow += rows;
+        if (region.lastOfLevel) {
+            finishedLevels.push_back(static_cast<uint32_t>(m_nextLevel));
+            --m_nextLevel;
+            m_nextRow = 0;
+        }
+    }
+
+    transferQueue.flushBackground();
+    m_pendingSerial = transferQueue.submittedSerial();
+    for (uint32_t level : finishedLevels) {
+        m_levelSerials[level] = m_pendingSerial;
+    }
+    return total;
+}
+
+bool TextureStreamer::updateResidency(const TransferQueue& transferQueue)
+{
+    uint32_t residentLevel = m_residentLevel;
+    while (m_residentLevel > 0 && m_levelSerials[m_residentLevel - 1] <= transferQueue.completedSerial()) {
+        --m_residentLevel;
+    }
+    if (m_residentLevel == residentLevel) return false;
+
+    spdlog::debug("Texture resident from mip level {}", m_residentLevel);
+    return true;
+}
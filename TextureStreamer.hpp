@@ -0,0 +1,81 @@
+﻿#pragma once
+#include "MeshCache.hpp"
+#include "TransferQueue.hpp"
+
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+// 一个 mip 层级的数据, 按纹素块紧密排列, 没有行填充
+struct TextureLevel {
+    VkExtent3D extent{};
+    const uint8_t* data = nullptr;
+    VkDeviceSize size = 0;
+};
+
+// 预先生成好完整 mip 链的纹理, levels[0] 最大; 数据指向 file 的映射 (内置纹理指向静态数据)
+struct TextureSource {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    std::vector<TextureLevel> levels;
+    std::unique_ptr<MappedFile> file;
+};
+
+// 渐进式纹理流送: 图像按完整的 mip 链创建, 从最小的层级开始上传; 最小的几个层级随第一帧上传, 纹理立即可用,
+// 其余层级按块行切分, 每帧在预算内提交后台传输批次, 批次完成后可采样的最大层级 (residentLevel) 逐级提高.
+// 还没有上传的层级处于 UNDEFINED 布局, 调用方用从 residentLevel 开始的图像视图采样
+class TextureStreamer {
+public:
+    // 读取不带超压缩的二维 KTX2 文件 (单层、单面), 数据保持在映射里; 格式不受支持或文件损坏时抛出异常
+    static TextureSource loadKtx2(const std::filesystem::path& path);
+    // 1x1 的白色纹理, 没有指定纹理时使用
+    static TextureSource whiteTexture();
+
+    // queueFamilies 多于一个时图像以 CONCURRENT 模式共享, 应当包含传输队列和所有采样它的队列
+    TextureStreamer(VkDevice device, VmaAllocator allocator, const std::vector<uint32_t>& queueFamilies, TextureSource source);
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+    ~TextureStreamer();
+
+    VkImage image() const noexcept { return m_image; }
+    VkFormat format() const noexcept { return m_source.format; }
+    uint32_t levelCount() const noexcept { return static_cast<uint32_t>(m_source.levels.size()); }
+    // 可以采样的最大层级, 它和更小的层级都已上传
+    uint32_t residentLevel() const noexcept { return m_residentLevel; }
+    bool streaming() const noexcept { return m_residentLevel > 0; }
+
+    // 从最小的层级开始排队完整的层级, 总量不超过 budget (至少一个层级); 它们随调用方下一次 flush 一起上传,
+    // 采样前等待的就是那次 flush 的信号量, 所以立即计为已驻留
+    void uploadInitial(TransferQueue& transferQueue, VkDeviceSize budget);
+    // 排队下一段不超过 budget 的数据 (至少一个块行) 并作为后台批次提交; 上一个后台批次还没完成, 或者队列里有调用方排队的拷贝时
+    // 什么也不做, 流送速度因此不超过传输队列的速度, 也不会把普通拷贝的信号量推迟. 返回提交的字节数
+    VkDeviceSize stream(TransferQueue& transferQueue, VkDeviceSize budget);
+    // 按已完成的批次提高 residentLevel, 改变时返回 true, 调用方需要重建图像视图
+    bool updateResidency(const TransferQueue& transferQueue);
+
+private:
+    struct BlockInfo {
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytes;
+    };
+    static BlockInfo blockInfo(VkFormat format);
+
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    TextureSource m_source;
+    BlockInfo m_block;
+    VkImage m_image = VK_NULL_HANDLE;
+    VmaAllocation m_allocation = VK_NULL_HANDLE;
+
+    uint32_t m_residentLevel;
+    // 正在上传的层级和其中下一个块行; 层级从大编号 (小尺寸) 向 0 推进, 全部排完后为 -1
+    int32_t m_nextLevel;
+    uint32_t m_nextRow = 0;
+    // 各层级最后一段所在批次的序号, 还没排完的层级是 UINT64_MAX
+    std::vector<uint64_t> m_levelSerials;
+    uint64_t m_pendingSerial = 0;
+};
@@ -0,0 +1,253 @@
+﻿#include "Tracer.hpp"
+
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+Tracer::Tracer()
+    : m_origin(Clock::now())
+{
+}
+
+void Tracer::start(const std::filesystem::path& file)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file = file;
+    m_origin = Clock::now();
+    for (auto& thread : m_threads) {
+        thread->written.store(0, std::memory_order_relaxed);
+        thread->previousOwners.clear();
+    }
+    m_enabled.store(true, std::memory_order_release);
+    spdlog::info("Tracing to {}", m_file.string());
+}
+
+void Tracer::stop()
+{
+    if (!m_enabled.exchange(false)) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 关闭之前已经确认启用的线程可能还在写入, 等它们写完; 之后的记录都会看到关闭
+    for (const auto& thread : m_threads) {
+        while (thread->writing.load()) {
+            std::this_thread::yield();
+        }
+    }
+    writeJson();
+}
+
+Tracer::ThreadRegistration::~ThreadRegistration()
+{
+    if (buffer == nullptr) return;
+
+    Tracer& tracer = Tracer::getInstance();
+    std::lock_guard<std::mutex> lock(tracer.m_mutex);
+    // 只有带名字的线程需要在时间线上补写名字
+    if (!buffer->threadName.empty()) {
+        buffer->previousOwners.push_back({ buffer->threadId, std::move(buffer->threadName), buffer->written.load(std::memory_order_relaxed) });
+    }
+    buffer->threadName.clear();
+    tracer.m_freeThreads.push_back(buffer);
+}
+
+Tracer::ThreadBuffer* Tracer::threadBuffer() noexcept
+{
+    // 每个线程第一次记录时取得一个缓冲区, 之后不再加锁; 优先复用已退出线程的缓冲区, 缓冲区总数不超过同时记录的线程数
+    thread_local ThreadRegistration t_registration;
+    if (t_registration.buffer == nullptr) {
+        try {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_freeThreads.empty()) {
+                ThreadBuffer* buffer = m_freeThreads.back();
+                m_freeThreads.pop_back();
+                // 之前的所属线程的事件都已被覆盖时不再需要它的名字
+                uint64_t written = buffer->written.load(std::memory_order_relaxed);
+                auto& owners = buffer->previousOwners;
+                owners.erase(std::remove_if(owners.begin(), owners.end(), [written](const PreviousOwner& owner) {
+                    return owner.written + s_eventsPerThread <= written;
+                }), owners.end());
+                t_registration.buffer = buffer;
+            }
+            else {
+                auto buffer = std::make_unique<ThreadBuffer>();
+                buffer->events.resize(s_eventsPerThread);
+                m_threads.push_back(std::move(buffer));
+                t_registration.buffer = m_threads.back().get();
+            }
+            t_registration.buffer->threadId = ++m_nextThreadId;
+            t_registration.buffer->threadName.clear();
+        }
+        catch (...) {
+            return nullptr;
+        }
+    }
+    return t_registration.buffer;
+}
+
+int64_t Tracer::toNS(Clock::time_point time) const noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - m_origin).count();
+}
+
+void Tracer::push(const Event& event) noexcept
+{
+    ThreadBuffer* buffer = threadBuffer();
+    if (buffer == nullptr) return;
+
+    // 与 stop 配对: 这里先标记写入再确认仍然启用, stop 先关闭再等标记清除, 两边都是顺序一致的原子操作,
+    // 所以要么这里看到关闭, 要么 stop 等到这次写入完成
+    buffer->writing.store(true);
+    if (m_enabled.load()) {
+        uint64_t index = buffer->written.load(std::memory_order_relaxed);
+        Event& slot = buffer->events[index % s_eventsPerThread];
+        slot = event;
+        slot.threadId = buffer->threadId;
+        buffer->written.store(index + 1, std::memory_order_release);
+    }
+    buffer->writing.store(false, std::memory_order_release);
+}
+
+void Tracer::complete(const char* category, const char* name, Clock::time_point begin, Clock::time_point end) noexcept
+{
+    if (!enabled()) return;
+
+    Event event;
+    event.category = category;
+    event.name = name;
+    event.beginNS = toNS(begin);
+    event.durationNS = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    event.phase = 'X';
+    push(event);
+}
+
+void Tracer::asyncBegin(const char* category, const char* name, uint64_t id) noexcept
+{
+    if (!enabled()) return;
+
+    Event event;
+    event.category = category;
+    event.name = name;
+    event.id = id;
+    event.beginNS = toNS(Clock::now());
+    event.phase = 'b';
+    push(event);
+}
+
+void Tracer::asyncEnd(const char* category, const char* name, uint64_t id) noexcept
+{
+    if (!enabled()) return;
+
+    Event event;
+    event.category = category;
+    event.name = name;
+    event.id = id;
+    event.beginNS = toNS(Clock::now());
+    event.phase = 'e';
+    push(event);
+}
+
+void Tracer::instant(const char* category, const char* name) noexcept
+{
+    if (!enabled()) return;
+
+    Event event;
+    event.category = category;
+    event.name = name;
+    event.beginNS = toNS(Clock::now());
+    event.phase = 'i';
+    push(event);
+}
+
+const char* Tracer::intern(const std::string& text)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_strings.insert(text).first->c_str();
+}
+
+void Tracer::setThreadName(const std::string& name)
+{
+    if (!enabled()) return;
+
+    ThreadBuffer* buffer = threadBuffer();
+    if (buffer == nullptr) return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    buffer->threadName = name;
+}
+
+static void writeEscaped(std::ofstream& out, const char* text)
+{
+    for (const char* c = text; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\';
+        }
+        out << *c;
+    }
+}
+
+bool Tracer::writeJson() const
+{
+    std::ofstream out(m_file, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+        spdlog::warn("Failed to open {} for writing", m_file.string());
+        return false;
+    }
+
+    // 时间单位是微秒, 保留三位小数即纳秒精度
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"ph\":\"M\",\"pid\":1,\"tid\":0,\"name\":\"process_name\",\"args\":{\"name\":\"VulkanCube\"}}";
+
+    uint64_t eventCount = 0;
+    uint64_t droppedCount = 0;
+    auto writeThreadName = [&out](uint32_t threadId, const std::string& name) {
+        out << ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << threadId << ",\"name\":\"thread_name\",\"args\":{\"name\":\"";
+        writeEscaped(out, name.c_str());
+        out << "\"}}";
+    };
+    for (const auto& thread : m_threads) {
+        uint64_t written = thread->written.load(std::memory_order_acquire);
+        uint64_t first = written > s_eventsPerThread ? written - s_eventsPerThread : 0;
+        if (!thread->threadName.empty()) {
+            writeThreadName(thread->threadId, thread->threadName);
+        }
+        for (const auto& owner : thread->previousOwners) {
+            if (owner.written > first) {
+                writeThreadName(owner.threadId, owner.threadName);
+            }
+        }
+
+        droppedCount += first;
+        for (uint64_t i = first; i < written; ++i) {
+            const Event& event = thread->events[i % s_eventsPerThread];
+            out << ",\n{\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":" << event.threadId << ",\"cat\":\"";
+            writeEscaped(out, event.category);
+            out << "\",\"name\":\"";
+            writeEscaped(out, event.name);
+            out << "\",\"ts\":" << event.beginNS / 1000.0;
+            if (event.phase == 'X') {
+                out << ",\"dur\":" << event.durationNS / 1000.0;
+            }
+            else if (event.phase == 'b' || event.phase == 'e') {
+                out << ",\"id\":" << event.id;
+            }
+            else if (event.phase == 'i') {
+                out << ",\"s\":\"t\"";
+            }
+            out << "}";
+            ++eventCount;
+        }
+    }
+    out << "\n]}\n";
+
+    if (!out.good()) {
+        spdlog::warn("Failed to write trace to {}", m_file.string());
+        return false;
+    }
+    if (droppedCount > 0) {
+        spdlog::warn("Trace ring buffers overflowed, {} oldest events were dropped", droppedCount);
+    }
+    spdlog::info("Trace with {} events written to {}", eventCount, m_file.string());
+    return true;
+}
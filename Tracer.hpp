@@ -0,0 +1,129 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// 输出 Chrome trace event 格式(可直接用 Perfetto / chrome://tracing 打开)的轻量追踪:
+// 每个线程写自己的环形缓冲区, 记录时不加锁也不分配内存 (第一次记录时取得缓冲区除外), 缓冲区写满后覆盖最旧的事件;
+// 线程退出后它的缓冲区留给之后新建的线程继续使用, 新线程取得新的编号, 事件各自记下所属线程. 停止时等正在写入的线程写完, 再统一写成 JSON
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static Tracer& getInstance() {
+        static Tracer s_tracerInstance;
+        return s_tracerInstance;
+    }
+
+    void start(const std::filesystem::path& file);
+    // 停止记录并把所有线程的事件写入 start 指定的文件
+    void stop();
+
+    bool enabled() const noexcept { return m_enabled.load(std::memory_order_relaxed); }
+
+    // name 和 category 只保存指针, 必须在整个程序运行期间有效; 动态字符串先用 intern 转换
+    void complete(const char* category, const char* name, Clock::time_point begin, Clock::time_point end) noexcept;
+    void asyncBegin(const char* category, const char* name, uint64_t id) noexcept;
+    void asyncEnd(const char* category, const char* name, uint64_t id) noexcept;
+    void instant(const char* category, const char* name) noexcept;
+
+    const char* intern(const std::string& text);
+    // 设置当前线程在时间线上显示的名字
+    void setThreadName(const std::string& name);
+
+private:
+    static const size_t s_eventsPerThread = 1 << 16;
+
+    struct Event {
+        const char* category = nullptr;
+        const char* name = nullptr;
+        uint64_t id = 0;
+        int64_t beginNS = 0;
+        int64_t durationNS = 0;
+        char phase = 'X';
+        uint32_t threadId = 0;
+    };
+    // 缓冲区之前的所属线程; 它的事件在被覆盖之前仍要显示它的名字
+    struct PreviousOwner {
+        uint32_t threadId = 0;
+        std::string threadName;
+        // 退出时缓冲区已写入的事件数
+        uint64_t written = 0;
+    };
+    struct ThreadBuffer {
+        // 当前所属线程的编号和名字, 取得缓冲区时重新分配
+        uint32_t threadId = 0;
+        std::string threadName;
+        std::vector<PreviousOwner> previousOwners;
+        std::vector<Event> events;
+        // 只有所属线程写入, 写完事件后再发布
+        std::atomic<uint64_t> written{ 0 };
+        // 所属线程正在写入事件, stop 等它清除后才读取
+        std::atomic<bool> writing{ false };
+    };
+    // 线程退出时把缓冲区交还给 Tracer
+    struct ThreadRegistration {
+        ThreadBuffer* buffer = nullptr;
+        ~ThreadRegistration();
+    };
+
+    Tracer();
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // 内存不足时返回 nullptr, 事件被丢弃
+    ThreadBuffer* threadBuffer() noexcept;
+    void push(const Event& event) noexcept;
+    int64_t toNS(Clock::time_point time) const noexcept;
+    bool writeJson() const;
+
+    std::atomic<bool> m_enabled{ false };
+    Clock::time_point m_origin;
+    std::filesystem::path m_file;
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> m_threads;
+    // 所属线程已经退出、可以复用的缓冲区
+    std::vector<ThreadBuffer*> m_freeThreads;
+    uint32_t m_nextThreadId = 0;
+    std::unordered_set<std::string> m_strings;
+};
+
+// 作用域追踪: 构造时记下开始时间, 析构时写入一个完整事件; 未启用时只有一次原子读
+class TraceScope {
+public:
+    TraceScope(const char* category, const char* name) noexcept
+        : m_category(category), m_name(name), m_active(Tracer::getInstance().enabled())
+    {
+        if (m_active) {
+            m_begin = Tracer::Clock::now();
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+    ~TraceScope()
+    {
+        if (m_active) {
+            Tracer::getInstance().complete(m_category, m_name, m_begin, Tracer::Clock::now());
+        }
+    }
+
+private:
+    const char* m_category;
+    const char* m_name;
+    bool m_active;
+    Tracer::Clock::time_point m_begin;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(category, name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(category, name)
+#define TRACE_FUNCTION(category) TRACE_SCOPE(category, __func__)
+#define TRACE_ASYNC_BEGIN(category, name, id) Tracer::getInstance().asyncBegin(category, name, id)
+#define TRACE_ASYNC_END(category, name, id) Tracer::getInstance().asyncEnd(category, name, id)
+#define TRACE_INSTANT(category, name) Tracer::getInstance().instant(category, name)
@@ -0,0 +1,273 @@
+﻿#include "TransferQueue.hpp"
+#include "Tracer.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+TransferQueue::TransferQueue(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamilyIndex, uint32_t consumerCount)
+    : m_device(device), m_allocator(allocator), m_queue(queue), m_waitSemaphores(consumerCount)
+{
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create transfer command pool!");
+    }
+}
+
+TransferQueue::~TransferQueue()
+{
+    waitIdle();
+    for (auto semaphore : m_allSemaphores) {
+        vkDestroySemaphore(m_device, semaphore, nullptr);
+    }
+    vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+}
+
+void TransferQueue::enqueue(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+    // 同一批次里对同一区域的重复写入只保留最后一次, 避免一次提交中出现重叠的拷贝
+    for (const auto& copy : m_copies) {
+        if (copy.dstBuffer == dstBuffer && copy.region.dstOffset == dstOffset && copy.region.size == size) {
+            memcpy(m_stagingData.data() + copy.region.srcOffset, data, static_cast<size_t>(size));
+            return;
+        }
+    }
+
+    Copy copy;
+    copy.dstBuffer = dstBuffer;
+    copy.region.srcOffset = m_stagingData.size();
+    copy.region.dstOffset = dstOffset;
+    copy.region.size = size;
+    m_copies.push_back(copy);
+    m_stagingData.insert(m_stagingData.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+}
+
+void TransferQueue::enqueueImage(const ImageRegion& region, const void* data, VkDeviceSize size)
+{
+    // bufferOffset 必须是 4 和纹素块大小的倍数, 16 对所有支持的格式都满足
+    m_stagingData.resize((m_stagingData.size() + 15) / 16 * 16);
+    ImageCopy copy;
+    copy.region = region;
+    copy.srcOffset = m_stagingData.size();
+    m_imageCopies.push_back(copy);
+    m_stagingData.insert(m_stagingData.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+}
+
+VkDeviceSize TransferQueue::flush()
+{
+    return submit(false);
+}
+
+VkDeviceSize TransferQueue::flushBackground()
+{
+    return submit(true);
+}
+
+VkDeviceSize TransferQueue::submit(bool background)
+{
+    if (empty()) return 0;
+
+    TRACE_FUNCTION("transfer");
+    Batch batch;
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = m_stagingData.size();
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_UNKNOWN;
+    allocCreateInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    allocCreateInfo.preferredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    allocCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocInfo{};
+    if (vmaCreateBuffer(m_allocator, &bufferInfo, &allocCreateInfo, &batch.stagingBuffer, &batch.stagingAllocation, &allocInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create staging buffer!");
+    }
+    memcpy(allocInfo.pMappedData, m_stagingData.data(), m_stagingData.size());
+    vmaFlushAllocation(m_allocator, batch.stagingAllocation, 0, VK_WHOLE_SIZE);
+
+    VkCommandBufferAllocateInfo commandBufferInfo{};
+    commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferInfo.commandPool = m_commandPool;
+    commandBufferInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(m_device, &commandBufferInfo, &batch.commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate transfer command buffer!");
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+    // 同一目标缓冲区的相邻拷贝合并成一次 vkCmdCopyBuffer
+    size_t first = 0;
+    std::vector<VkBufferCopy> regions;
+    for (size_t i = 0; i <= m_copies.size() && !m_copies.empty(); ++i) {
+        if (i == m_copies.size() || m_copies[i].dstBuffer != m_copies[first].dstBuffer) {
+            vkCmdCopyBuffer(batch.commandBuffer, batch.stagingBuffer, m_copies[first].dstBuffer, static_cast<uint32_t>(regions.size()), regions.data());
+            regions.clear();
+            first = i;
+        }
+        if (i < m_copies.size()) {
+            regions.push_back(m_copies[i].region);
+        }
+    }
+    recordImageCopies(batch.commandBuffer, batch.stagingBuffer);
+    vkEndCommandBuffer(batch.commandBuffer);
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkCreateFence(m_device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create transfer fence!");
+    }
+
+    std::vector<VkSemaphore> signalSemaphores;
+    for (auto& waits : m_waitSemaphores) {
+        signalSemaphores.push_back(acquireSemaphore());
+        if (!background) {
+            waits.push_back(signalSemaphores.back());
+        }
+    }
+    if (background) {
+        batch.deferredWaits = signalSemaphores;
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+    submitInfo.pSignalSemaphores = signalSemaphores.data();
+    if (vkQueueSubmit(m_queue, 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit transfer batch!");
+    }
+    batch.serial = ++m_submittedSerial;
+    m_batches.push_back(batch);
+
+    VkDeviceSize size = m_stagingData.size();
+    m_copies.clear();
+    m_imageCopies.clear();
+    m_stagingData.clear();
+    return size;
+}
+
+void TransferQueue::recordImageCopies(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer)
+{
+    if (m_imageCopies.empty()) return;
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+
+    // 层级还没有被采样过, 直接从 UNDEFINED 转换
+    std::vector<VkImageMemoryBarrier> barriers;
+    for (const auto& copy : m_imageCopies) {
+        if (!copy.region.firstOfLevel) continue;
+        barrier.image = copy.region.image;
+        barrier.subresourceRange.baseMipLevel = copy.region.mipLevel;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers.push_back(barrier);
+    }
+    if (!barriers.empty()) {
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+            static_cast<uint32_t>(barriers.size()), barriers.data());
+    }
+
+    for (const auto& copy : m_imageCopies) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = copy.srcOffset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = copy.region.mipLevel;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = copy.region.offset;
+        region.imageExtent = copy.region.extent;
+        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, copy.region.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+
+    // 写入对使用方的可见性由它等待的信号量保证, 这里只做布局转换
+    barriers.clear();
+    for (const auto& copy : m_imageCopies) {
+        if (!copy.region.lastOfLevel) continue;
+        barrier.image = copy.region.image;
+        barrier.subresourceRange.baseMipLevel = copy.region.mipLevel;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        barriers.push_back(barrier);
+    }
+    if (!barriers.empty()) {
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
+            static_cast<uint32_t>(barriers.size()), barriers.data());
+    }
+}
+
+std::vector<VkSemaphore> TransferQueue::takeWaitSemaphores(uint32_t consumer)
+{
+    std::vector<VkSemaphore> semaphores;
+    semaphores.swap(m_waitSemaphores[consumer]);
+    return semaphores;
+}
+
+void TransferQueue::recycleSemaphores(const std::vector<VkSemaphore>& semaphores)
+{
+    m_freeSemaphores.insert(m_freeSemaphores.end(), semaphores.begin(), semaphores.end());
+}
+
+void TransferQueue::collect()
+{
+    // 同一队列上的批次按顺序完成
+    while (!m_batches.empty() && vkGetFenceStatus(m_device, m_batches.front().fence) == VK_SUCCESS) {
+        retire(m_batches.front());
+        m_batches.pop_front();
+    }
+}
+
+void TransferQueue::waitIdle()
+{
+    for (auto& batch : m_batches) {
+        vkWaitForFences(m_device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        retire(batch);
+    }
+    m_batches.clear();
+}
+
+VkSemaphore TransferQueue::acquireSemaphore()
+{
+    if (!m_freeSemaphores.empty()) {
+        VkSemaphore semaphore = m_freeSemaphores.back();
+        m_freeSemaphores.pop_back();
+        return semaphore;
+    }
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkSemaphore semaphore;
+    if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create transfer semaphore!");
+    }
+    m_allSemaphores.push_back(semaphore);
+    return semaphore;
+}
+
+void TransferQueue::retire(Batch& batch)
+{
+    for (size_t consumer = 0; consumer < batch.deferredWaits.size(); ++consumer) {
+        m_waitSemaphores[consumer].push_back(batch.deferredWaits[consumer]);
+    }
+    m_completedSerial = batch.serial;
+    vkFreeCommandBuffers(m_device, m_commandPool, 1, &batch.commandBuffer);
+    vkDestroyFence(m_device, batch.fence, nullptr);
+    vmaDestroyBuffer(m_allocator, batch.stagingBuffer, batch.stagingAllocation);
+}
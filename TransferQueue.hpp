@@ -0,0 +1,97 @@
+﻿#pragma once
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// 异步批量上传: 排队的缓冲区和图像拷贝在 flush 时合并到一个暂存缓冲区和一次提交, 提交到专用传输队列(没有时用图形队列),
+// 不等待完成; 批次用 fence 跟踪暂存资源的回收, 每个使用方(图形队列、异步计算队列)各得到一个信号量, 在首次读取前等待
+class TransferQueue {
+public:
+    // 图像某个 mip 层级中的一块区域
+    struct ImageRegion {
+        VkImage image = VK_NULL_HANDLE;
+        uint32_t mipLevel = 0;
+        VkOffset3D offset{};
+        VkExtent3D extent{};
+        // 层级的第一块拷贝前从 UNDEFINED 转到 TRANSFER_DST_OPTIMAL (丢弃旧内容), 最后一块拷贝后转到 SHADER_READ_ONLY_OPTIMAL;
+        // 同一层级的各块按顺序排队, 可以分在多个批次
+        bool firstOfLevel = true;
+        bool lastOfLevel = true;
+    };
+
+    TransferQueue(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamilyIndex, uint32_t consumerCount);
+    TransferQueue(const TransferQueue&) = delete;
+    TransferQueue& operator=(const TransferQueue&) = delete;
+    ~TransferQueue();
+
+    // 数据立即复制到 CPU 侧; 目标区域在对应批次的信号量被等待之前不能被 GPU 读取, 也不能正被 GPU 读取;
+    // 同一批次中的目标区域要么完全相同(后写的覆盖先写的), 要么互不重叠
+    void enqueue(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+    // 颜色图像, 数据紧密排列; 图像以 CONCURRENT 模式与使用方的队列族共享, 不做所有权转移
+    void enqueueImage(const ImageRegion& region, const void* data, VkDeviceSize size);
+
+    bool empty() const noexcept { return m_copies.empty() && m_imageCopies.empty(); }
+
+    // 把排队的拷贝合并成一次提交, 返回该批次的字节数; 没有排队的拷贝时什么也不做
+    VkDeviceSize flush();
+    // 与 flush 相同, 但使用方的信号量在批次完成之后才交出, 等待它们不会停顿; 用 completedSerial 判断批次是否完成
+    VkDeviceSize flushBackground();
+
+    // 最近一次提交的批次序号, 从 1 开始
+    uint64_t submittedSerial() const noexcept { return m_submittedSerial; }
+    // 已回收的批次中最大的序号; 后台批次回收时它的信号量已经交给使用方
+    uint64_t completedSerial() const noexcept { return m_completedSerial; }
+
+    // 取走 consumer 尚未等待过的批次信号量, 调用方必须在它的下一次提交中全部等待,
+    // 并在那次提交完成之后用 recycleSemaphores 归还
+    std::vector<VkSemaphore> takeWaitSemaphores(uint32_t consumer);
+    void recycleSemaphores(const std::vector<VkSemaphore>& semaphores);
+
+    // 回收 fence 已触发的批次的暂存缓冲区和命令缓冲区, 不阻塞
+    void collect();
+
+    // 阻塞到所有已提交的批次完成, 退出和需要同步读回时使用
+    void waitIdle();
+
+private:
+    struct Copy {
+        VkBuffer dstBuffer = VK_NULL_HANDLE;
+        VkBufferCopy region{};
+    };
+    struct ImageCopy {
+        ImageRegion region;
+        VkDeviceSize srcOffset = 0;
+    };
+    struct Batch {
+        VkBuffer stagingBuffer = VK_NULL_HANDLE;
+        VmaAllocation stagingAllocation = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        uint64_t serial = 0;
+        // 后台批次完成后才交给各使用方的信号量, 按使用方编号排列
+        std::vector<VkSemaphore> deferredWaits;
+    };
+
+    VkDeviceSize submit(bool background);
+    void recordImageCopies(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer);
+    VkSemaphore acquireSemaphore();
+    void retire(Batch& batch);
+
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    VkQueue m_queue;
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+
+    std::vector<Copy> m_copies;
+    std::vector<ImageCopy> m_imageCopies;
+    std::vector<uint8_t> m_stagingData;
+    std::deque<Batch> m_batches;
+    std::vector<std::vector<VkSemaphore>> m_waitSemaphores;
+    std::vector<VkSemaphore> m_freeSemaphores;
+    std::vector<VkSemaphore> m_allSemaphores;
+    uint64_t m_submittedSerial = 0;
+    uint64_t m_completedSerial = 0;
+};
@@ -0,0 +1,112 @@
+﻿#include "VertexPacking.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+template <typename T>
+static void appendComponents(std::vector<uint8_t>& data, const T (&components)[4])
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(components);
+    data.insert(data.end(), bytes, bytes + sizeof(components));
+}
+
+PackedPositions packPositions(const std::vector<glm::vec4>& positions, const std::function<bool(VkFormat)>& isVertexFormatSupported)
+{
+    auto isInt16 = [](float value) {
+        return value == std::round(value) && value >= std::numeric_limits<int16_t>::min() && value <= std::numeric_limits<int16_t>::max();
+    };
+    bool integral = true;
+    bool halfExact = true;
+    bool integralW = true;
+    glm::vec3 minimum(std::numeric_limits<float>::max());
+    glm::vec3 maximum(std::numeric_limits<float>::lowest());
+    for (const auto& position : positions) {
+        for (int i = 0; i < 4; ++i) {
+            float value = position[i];
+            if (!isInt16(value)) {
+                integral = false;
+            }
+            if (glm::unpackHalf1x16(glm::packHalf1x16(value)) != value) {
+                halfExact = false;
+            }
+        }
+        integralW = integralW && isInt16(position.w);
+        minimum = glm::min(minimum, glm::vec3(position));
+        maximum = glm::max(maximum, glm::vec3(position));
+    }
+
+    PackedPositions packed;
+    if (integral && isVertexFormatSupported(VK_FORMAT_R16G16B16A16_SSCALED)) {
+        packed.format = VK_FORMAT_R16G16B16A16_SSCALED;
+        packed.stride = 4 * sizeof(int16_t);
+        packed.data.reserve(positions.size() * packed.stride);
+        for (const auto& position : positions) {
+            int16_t components[4] = { static_cast<int16_t>(position.x), static_cast<int16_t>(position.y), static_cast<int16_t>(position.z), static_cast<int16_t>(position.w) };
+            appendComponents(packed.data, components);
+        }
+    }
+    else if (halfExact && isVertexFormatSupported(VK_FORMAT_R16G16B16A16_SFLOAT)) {
+        packed.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        packed.stride = 4 * sizeof(uint16_t);
+        packed.data.reserve(positions.size() * packed.stride);
+        for (const auto& position : positions) {
+            uint16_t components[4] = { glm::packHalf1x16(position.x), glm::packHalf1x16(position.y), glm::packHalf1x16(position.z), glm::packHalf1x16(position.w) };
+            appendComponents(packed.data, components);
+        }
+    }
+    else if (integralW && isVertexFormatSupported(VK_FORMAT_R16G16B16A16_SNORM)) {
+        // SNORM 还原成 分量 / 32767; xyz 映射到包围盒, 退化的轴不缩放; w 存整数本身, 还原时乘回 32767
+        glm::vec3 center = positions.empty() ? glm::vec3(0.f) : (minimum + maximum) * 0.5f;
+        glm::vec3 halfRange = positions.empty() ? glm::vec3(1.f) : (maximum - minimum) * 0.5f;
+        for (int i = 0; i < 3; ++i) {
+            if (!(halfRange[i] > 0.f)) halfRange[i] = 1.f;
+        }
+        packed.format = VK_FORMAT_R16G16B16A16_SNORM;
+        packed.stride = 4 * sizeof(int16_t);
+        packed.scale = glm::vec4(halfRange, 32767.f);
+        packed.offset = glm::vec4(center, 0.f);
+        packed.data.reserve(positions.size() * packed.stride);
+        for (const auto& position : positions) {
+            glm::vec3 normalized = glm::clamp((glm::vec3(position) - center) / halfRange, -1.f, 1.f) * 32767.f;
+            int16_t components[4] = { static_cast<int16_t>(std::round(normalized.x)), static_cast<int16_t>(std::round(normalized.y)),
+                static_cast<int16_t>(std::round(normalized.z)), static_cast<int16_t>(position.w) };
+            appendComponents(packed.data, components);
+        }
+    }
+    else {
+        packed.data.resize(positions.size() * sizeof(glm::vec4));
+        memcpy(packed.data.data(), positions.data(), packed.data.size());
+    }
+    return packed;
+}
+
+uint32_t packColor(const glm::vec4& color)
+{
+    return glm::packUnorm4x8(color);
+}
+
+const char* vertexFormatName(VkFormat format)
+{
+    switch (format) {
+    case VK_FORMAT_R16G16B16A16_SSCALED: return "R16G16B16A16_SSCALED";
+    case VK_FORMAT_R16G16B16A16_SFLOAT: return "R16G16B16A16_SFLOAT";
+    case VK_FORMAT_R16G16B16A16_SNORM: return "R16G16B16A16_SNORM";
+    case VK_FORMAT_R32G32B32A32_SFLOAT: return "R32G32B32A32_SFLOAT";
+    case VK_FORMAT_R8G8B8A8_UNORM: return "R8G8B8A8_UNORM";
+    default: return "unknown";
+    }
+}
+
+uint32_t vertexFormatSize(VkFormat format)
+{
+    switch (format) {
+    case VK_FORMAT_R16G16B16A16_SSCALED:
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R16G16B16A16_SNORM: return 4 * sizeof(int16_t);
+    case VK_FORMAT_R32G32B32A32_SFLOAT: return 4 * sizeof(float);
+    default: return 0;
+    }
+}
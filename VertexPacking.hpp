@@ -0,0 +1,31 @@
+﻿#pragma once
+#include <vulkan/vulkan.h>
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// 打包好的顶点位置, 直接作为顶点缓冲区上传; 无论哪种格式, 着色器里都按 vec4 读取, 再乘 scale 加 offset 还原
+struct PackedPositions {
+    VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    uint32_t stride = sizeof(glm::vec4);
+    glm::vec4 scale{ 1.f };
+    glm::vec4 offset{ 0.f };
+    std::vector<uint8_t> data;
+};
+
+// 按坐标的取值选择最紧凑的格式: 全是 int16 范围内的整数时用 R16G16B16A16_SSCALED,
+// 全能用半精度精确表示时用 R16G16B16A16_SFLOAT, 这两种无损; 其余 (如倒角的网格) 按包围盒把 xyz 量化成
+// R16G16B16A16_SNORM, 误差不超过包围盒边长的 1/65534; 都不支持时保持 R32G32B32A32_SFLOAT.
+// w 分量由调用方使用 (如顶点所属的面号), 应当是小整数, 总是精确还原; isVertexFormatSupported 判断格式能否用作顶点属性, 不支持的格式会被跳过
+PackedPositions packPositions(const std::vector<glm::vec4>& positions, const std::function<bool(VkFormat)>& isVertexFormatSupported);
+
+// 打包成 R8G8B8A8_UNORM, 字节顺序与 VkFormat 和 GLSL 的 unpackUnorm4x8 一致
+uint32_t packColor(const glm::vec4& color);
+
+const char* vertexFormatName(VkFormat format);
+// packPositions 可能选择的格式每个顶点的字节数, 其他格式返回 0
+uint32_t vertexFormatSize(VkFormat format);
@@ -1,8 +1,9 @@
 ﻿#include "VulkanCube.hpp"
-/*
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
 
+#define VMA_IMPLEMENTATION
+#include <vk_mem_alloc.h>
+
+/*
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 */
@@ -12,13 +13,27 @@
 
 #include "ShaderCompiler.hpp"
 
-const uint32_t WIDTH = 1920;
-const uint32_t HEIGHT = 1080;
+const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+const std::string ALLOCATOR_STATS_PATH = "vma_stats.json";
+const std::string GPU_PROFILE_PATH = "gpu_profile.json";
+const std::string MESH_CACHE_DIRECTORY = "mesh_cache";
 
 //const std::string MODEL_PATH = "models/viking_room.obj";
-//const std::string TEXTURE_PATH = "textures/viking_room.png";
-
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// 后台流送纹理时每帧最多提交的字节数, 以及随第一帧上传的最小层级的总字节数
+static constexpr VkDeviceSize s_textureStreamBudget = 4 * 1024 * 1024;
+static constexpr VkDeviceSize s_textureInitialBudget = 256 * 1024;
+// 每个飞行帧在 FrameAllocator 中可用的字节数: 帧常量和帧内上传的暂存数据
+static constexpr VkDeviceSize s_frameAllocatorFrameBytes = 64 * 1024;
+
+const uint32_t MAX_FRAMES_IN_FLIGHT = FramePacer::s_maxFramesInFlight;
+// 大场景间接绘制缓冲区中绘制命令的起始偏移, 之前是 shaders/cull.comp 写入的各分区可见实例数
+static constexpr VkDeviceSize s_drawCommandOffset = sizeof(uint32_t) * CommandRecorder::s_maxPartitions;
+// TransferQueue 的使用方编号
+static constexpr uint32_t s_graphicsUploadConsumer = 0;
+static constexpr uint32_t s_computeUploadConsumer = 1;
+// 上传的数据可能被顶点输入、着色器和间接绘制读取; recordPendingUploads 在帧内用拷贝改写同一批缓冲区, 拷贝也要排在批次的写入之后
+static constexpr VkPipelineStageFlags s_uploadWaitStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+    VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
 static constexpr float s_fDet = 0.001f;
 
 const std::vector<const char*> validationLayers = {
@@ -35,6 +50,72 @@ static const bool enableValidationLayers = false;
 static const bool enableValidationLayers = true;
 #endif
 
+// 展开图的 24 个顶点, 每个面 4 个, 单个展开图和大场景共用
+static const std::vector<glm::vec3> s_netVertices = {
+    glm::vec3(-4.f, -1.f, 0.f), // 0
+    glm::vec3(-2.f, -1.f, 0.f), // 1
+    glm::vec3(-2.f,  1.f, 0.f), // 2
+    glm::vec3(-4.f,  1.f, 0.f), // 3
+    glm::vec3(-2.f, -3.f, 0.f), // 4
+    glm::vec3( 0.f, -3.f, 0.f), // 5
+    glm::vec3( 0.f, -1.f, 0.f), // 6
+    glm::vec3(-2.f, -1.f, 0.f), // 7
+    glm::vec3(-2.f, -1.f, 0.f), // 8
+    glm::vec3( 0.f, -1.f, 0.f), // 9
+    glm::vec3( 0.f,  1.f, 0.f), // 10
+    glm::vec3(-2.f,  1.f, 0.f), // 11
+    glm::vec3( 0.f, -1.f, 0.f), // 12
+    glm::vec3( 2.f, -1.f, 0.f), // 13
+    glm::vec3( 2.f,  1.f, 0.f), // 14
+    glm::vec3( 0.f,  1.f, 0.f), // 15
+    glm::vec3( 0.f,  1.f, 0.f), // 16
+    glm::vec3( 2.f,  1.f, 0.f), // 17
+    glm::vec3( 2.f,  3.f, 0.f), // 18
+    glm::vec3( 0.f,  3.f, 0.f), // 19
+    glm::vec3( 2.f, -1.f, 0.f), // 20
+    glm::vec3( 4.f, -1.f, 0.f), // 21
+    glm::vec3( 4.f,  1.f, 0.f), // 22
+    glm::vec3( 2.f,  1.f, 0.f), // 23
+};
+
+static const std::vector<uint16_t> s_netIndices = {
+     0,  1,  2,  0,  2,  3,
+     4,  5,  6,  4,  6,  7,
+     8,  9, 10,  8, 10, 11,
+    12, 13, 14, 12, 14, 15,
+    16, 17, 18, 16, 18, 19,
+    20, 21, 22, 20, 22, 23,
+};
+
+// 展开图中离 xy 最近的面, 导入的网格按多边形的重心用它分面
+static uint32_t netFaceAt(const glm::vec3& position) {
+    uint32_t nearest = 0;
+    float nearestDistance = std::numeric_limits<float>::max();
+    for (uint32_t face = 0; face < MassScene::s_faceCount; ++face) {
+        glm::vec2 lower = glm::vec2(s_netVertices[face * 4]);
+        glm::vec2 upper = glm::vec2(s_netVertices[face * 4 + 2]);
+        float distance = glm::length(glm::vec2(position) - glm::clamp(glm::vec2(position), lower, upper));
+        if (distance < nearestDistance) {
+            nearest = face;
+            nearestDistance = distance;
+        }
+    }
+    return nearest;
+}
+
+// 图像写出只处理每通道 8 位的 RGBA/BGRA, 10 位或浮点的交换链格式回读后无法直接写出
+static bool isCaptureFormatSupported(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+        return true;
+    default:
+        return false;
+    }
+}
+
 static bool fEqual(float _1, float _2) {
     return std::abs(_1 - _2) < s_fDet;
 }
@@ -46,8 +127,8 @@ static std::array<VkVertexInputBindingDescription, 2> getBindingDescription() {
     bindingDescription[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
     bindingDescription[1].binding = 1;
-    bindingDescription[1].stride = sizeof(glm::vec3);
-    bindingDescription[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    bindingDescription[1].stride = sizeof(uint32_t);
+    bindingDescription[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
     return bindingDescription;
 }
@@ -61,12 +142,96 @@ static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions
 
     attributeDescriptions[1].binding = 1;
     attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_UNORM;
     attributeDescriptions[1].offset = 0;
 
     return attributeDescriptions;
 }
 
+// 两条图形管线共用的固定功能状态, 整体创建和按图形管线库分块创建都从这里取; 内部指针指向自身成员, 不能复制
+struct FixedFunctionState {
+    std::array<VkVertexInputBindingDescription, 2> bindingDescription = getBindingDescription();
+    std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = getAttributeDescriptions();
+    std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineVertexInputStateCreateInfo vertexInput{};
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    VkPipelineViewportStateCreateInfo viewport{};
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    // 动态渲染时代替渲染通道描述附件格式
+    VkFormat colorFormat;
+    VkPipelineRenderingCreateInfoKHR renderingInfo{};
+
+    FixedFunctionState(VkSampleCountFlagBits samples, VkFormat colorAttachmentFormat, VkFormat depthAttachmentFormat)
+        : colorFormat(colorAttachmentFormat) {
+        vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInput.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescription.size());
+        vertexInput.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+        vertexInput.pVertexBindingDescriptions = bindingDescription.data();
+        vertexInput.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewport.viewportCount = 1;
+        viewport.scissorCount = 1;
+
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_NONE;
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = samples;
+
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
+
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachmentFormats = &colorFormat;
+        renderingInfo.depthAttachmentFormat = depthAttachmentFormat;
+    }
+    FixedFunctionState(const FixedFunctionState&) = delete;
+    FixedFunctionState& operator=(const FixedFunctionState&) = delete;
+
+    // 大场景只需要位置属性, 格式随打包结果而定; 面的颜色和变换从 SSBO 读取
+    void useMassVertexInput(const PackedPositions& positions) {
+        bindingDescription[0].stride = positions.stride;
+        attributeDescriptions[0].format = positions.format;
+        vertexInput.vertexBindingDescriptionCount = 1;
+        vertexInput.vertexAttributeDescriptionCount = 1;
+    }
+};
+
 static VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, 
     const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger) {
     auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
@@ -85,6 +250,32 @@ static void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMesse
     }
 }
 
+// 管线缓存文件头, 写在驱动返回的缓存数据之前, 用于在加载时校验设备和驱动是否一致
+struct PipelineCacheFileHeader {
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t vendorID = 0;
+    uint32_t deviceID = 0;
+    uint32_t driverVersion = 0;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE]{};
+    uint64_t dataSize = 0;
+    uint64_t dataHash = 0;
+    uint64_t coldBuildTimeUS = 0;
+};
+
+static constexpr uint32_t s_pipelineCacheMagic = 0x43505643; // "CVPC"
+static constexpr uint32_t s_pipelineCacheVersion = 1;
+
+static uint64_t fnv1aHash(const void* data, size_t size) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
 static bool isSamePointF(const glm::vec3& p1, const glm::vec3& p2) {
     if (std::abs(p1.x - p2.x) <= s_fDet && std::abs(p1.y - p2.y) <= s_fDet && std::abs(p1.z - p2.z) <= s_fDet)
         return true;
@@ -94,7 +285,10 @@ static bool isSamePointF(const glm::vec3& p1, const glm::vec3& p2) {
 /// <summary>
 /// 
 /// </summary>
-VulkanCube::VulkanCube()
+VulkanCube::VulkanCube(const AppConfig& config)
+    : config(config),
+    // 离屏渲染没有显示器刷新可以对齐, Auto 退化为吞吐模式
+    framePacer(config.headless && config.pacing == FramePacer::Mode::Auto ? FramePacer::Mode::Throughput : config.pacing)
 {
 #ifdef VK_USE_PLATFORM_WIN32_KHR
     SetConsoleOutputCP(CP_UTF8);
@@ -106,7 +300,14 @@ VulkanCube::VulkanCube()
     spdlog::set_level(spdlog::level::debug);
 #endif
     spdlog::set_pattern("[%H:%M:%S] [%^%l%$] %v");
-    initWindow();
+    if (!config.tracePath.empty()) {
+        Tracer::getInstance().start(config.tracePath);
+        Tracer::getInstance().setThreadName("main");
+    }
+    virtualTime = std::chrono::high_resolution_clock::now();
+    if (!config.headless) {
+        initWindow();
+    }
     initVulkan();
 }
 
@@ -117,57 +318,129 @@ VulkanCube::~VulkanCube()
 
 void VulkanCube::run() 
 {
+    if (config.headless) {
+        runHeadless();
+        return;
+    }
+
     spdlog::info("按 空格键 展开或折叠立方体");
     spdlog::info("按 S 暂停或继续动画");
     spdlog::info("按 R 居中展开图的位置");
+    spdlog::info("按 M 输出显存分配统计");
+    spdlog::info("按 G 输出 GPU 分段耗时统计");
     spdlog::info("展开时, 鼠标左键点击两个正方形, 将会自动验证第一个点击的正方形能否滚动到第二个选中的正方形旁, 如果验证通过会播放动画, 验证没通过则会提示错误");
     int width = 0, height = 0;
     bool minimized = false;
     while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+        if (framePacer.lowLatency()) {
+            // 先等上一帧完成, 再睡到唤醒时刻, 让输入尽可能晚地被采样
+            waitForFrameSlot();
+            framePacer.sleepUntilWake();
+        }
+        {
+            ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::PollEvents);
+            glfwPollEvents();
+        }
+        framePacer.onInputSampled();
 
         glfwGetFramebufferSize(window, &width, &height);
         minimized = (width == 0 || height == 0);
 
-        if (minimized && !previousWindowMinimizedStatus) {
-            previousWindowMinimizedStatus = true;
-            currentTime = std::chrono::high_resolution_clock::now();
-            periodTimeMS += std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count();
+        if (minimized) {
+            if (!previousWindowMinimizedStatus) {
+                previousWindowMinimizedStatus = true;
+                currentTime = animationNow();
+                periodTimeMS += std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count();
+            }
             glfwWaitEvents();
             continue;
         }
-        else if (!minimized && previousWindowMinimizedStatus) {
-            startTime = std::chrono::high_resolution_clock::now();
+        else if (previousWindowMinimizedStatus) {
+            startTime = animationNow();
             previousWindowMinimizedStatus = false;
         }
 
-        processAnimation();
+        {
+            ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::Animation);
+            processAnimation();
+        }
 
         drawFrame();
     }
 
     vkDeviceWaitIdle(device);
+    finishCapture();
+    if (!config.gpuProfilePath.empty()) {
+        dumpGpuProfile();
+    }
+}
+
+void VulkanCube::runHeadless()
+{
+    spdlog::info("Headless rendering {} frames at {}x{}", config.frameCount, swapChainExtent.width, swapChainExtent.height);
+    auto renderStart = std::chrono::high_resolution_clock::now();
+    for (uint32_t frame = 0; frame < config.frameCount; ++frame) {
+        // 没有键盘输入, 动画播完后自动折叠或展开, 保证每一帧都有内容变化
+        if (readyToAddAnimation()) {
+            addCubeAnimation();
+        }
+        framePacer.onInputSampled();
+
+        {
+            ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::Animation);
+            processAnimation();
+        }
+
+        drawFrame();
+
+        if (config.fixedFrameTimeMS > 0) {
+            virtualTime += std::chrono::milliseconds(config.fixedFrameTimeMS);
+        }
+    }
+    vkDeviceWaitIdle(device);
+
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count();
+    spdlog::info("Rendered {} frames in {:.3f} s ({:.1f} fps)", config.frameCount, seconds, seconds > 0.0 ? config.frameCount / seconds : 0.0);
+    frameProfiler.report();
+    finishCapture();
+    // 离屏渲染的最后几帧在 vkDeviceWaitIdle 之后才有结果
+    for (uint32_t frame = 0; frame < framesInFlight; ++frame) {
+        gpuProfiler->collect(frame);
+    }
+    if (!config.gpuProfilePath.empty()) {
+        dumpGpuProfile();
+    }
+}
+
+std::chrono::high_resolution_clock::time_point VulkanCube::animationNow() const
+{
+    if (config.headless && config.fixedFrameTimeMS > 0) {
+        return virtualTime;
+    }
+    return std::chrono::high_resolution_clock::now();
 }
 
 void VulkanCube::processAnimation()
 {
-    if (isPaused || previousWindowMinimizedStatus) return;
+    // 大场景的折叠按时间在 updateMassScene 中计算, 不走动画队列
+    if (isPaused || previousWindowMinimizedStatus || massScene) return;
     if (animationQueues.empty()) {
         if (rotating && is2D) {
             rotating = false;
-            initUBO();
+            resetUBO();
         }
         return;
     }
     const auto& animation = animationQueues.front();
     float clockWiseR = animation.clockWise ? -1.f : 1.f;
     if (!moving) {
+        TRACE_ASYNC_BEGIN("animation", "Animation", ++animationTraceId);
         interactive = animation.interactive;
         moving = true;
-        startTime = std::chrono::high_resolution_clock::now();
+        startTime = animationNow();
         moved_vertices = vertices;
     }
-    currentTime = std::chrono::high_resolution_clock::now();
+    currentTime = animationNow();
     auto timeI = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() + periodTimeMS;
     if (timeI == 0) return;
     if (timeI > s_msCount) {
@@ -180,8 +453,9 @@ void VulkanCube::processAnimation()
                 vertices[id] = glm::vec3(std::round(moved_vertices[id].x), std::round(moved_vertices[id].y), std::round(moved_vertices[id].z));
             }
         }
-        memcpy(vertexBufferMappedPtr, vertices.data(), vertices.size() * sizeof(vertices[0]));
+        writeBuffer(vertexBuffer, vertexBufferAllocation, vertexBufferMappedPtr, 0, vertices.data(), vertices.size() * sizeof(vertices[0]));
         animationQueues.pop();
+        TRACE_ASYNC_END("animation", "Animation", animationTraceId);
     }
     else {
         float time = static_cast<float>(timeI) / 1000.f;
@@ -194,7 +468,7 @@ void VulkanCube::processAnimation()
                 moved_vertices[id] = glm::vec3(transformMat * glm::vec4(vertices[id], 1.f));
             }
         }
-        memcpy(vertexBufferMappedPtr, moved_vertices.data(), moved_vertices.size() * sizeof(moved_vertices[0]));
+        writeBuffer(vertexBuffer, vertexBufferAllocation, vertexBufferMappedPtr, 0, moved_vertices.data(), moved_vertices.size() * sizeof(moved_vertices[0]));
     }
 
 }
@@ -248,7 +522,7 @@ void VulkanCube::resetFaceToCenter(TranslateType mask)
     for (auto& v : vertices) {
         v += translateDis;
     }
-    memcpy(vertexBufferMappedPtr, vertices.data(), sizeof(vertices[0]) * vertices.size());
+    writeBuffer(vertexBuffer, vertexBufferAllocation, vertexBufferMappedPtr, 0, vertices.data(), sizeof(vertices[0]) * vertices.size());
 
     spdlog::debug("Reset face position to center!");
 }
@@ -298,10 +572,10 @@ void VulkanCube::addCubeAnimation()
         }
 
         rotating = true;
-        rotateStartTime = std::chrono::high_resolution_clock::now();
+        rotateStartTime = animationNow();
     }
     else {
-        initUBO();
+        resetUBO();
         const auto faceIDs = getDirectionFaceIds();
         resetFaceToCenter(TranslateType::Open);
 
@@ -770,15 +1044,20 @@ bool VulkanCube::connectAlongAxis(const std::array<FaceInfo, 6>& faceInfos, size
 
 void VulkanCube::initWindow()
 {
+    TRACE_FUNCTION("vulkan");
     glfwInit();
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
-    window = glfwCreateWindow(WIDTH, HEIGHT, "VulkanCube", nullptr, nullptr);
+    window = glfwCreateWindow(static_cast<int>(config.width), static_cast<int>(config.height), "VulkanCube", nullptr, nullptr);
     glfwSetWindowUserPointer(window, this);
     glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
     glfwSetKeyCallback(window, keyCallback);
     glfwSetMouseButtonCallback(window, mouseButtonCallback);
+
+    if (const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor())) {
+        framePacer.setRefreshRate(mode->refreshRate);
+    }
 }
 
 void VulkanCube::framebufferResizeCallback(GLFWwindow* window, int width, int height)
@@ -801,6 +1080,12 @@ void VulkanCube::keyCallback(GLFWwindow* window, int key, int scancode, int acti
             if (app->is2D && app->animationQueues.empty())
                 app->resetFaceToCenter(TranslateType::Reset);
             break;
+        case GLFW_KEY_M:
+            app->dumpAllocatorStats(true);
+            break;
+        case GLFW_KEY_G:
+            app->dumpGpuProfile();
+            break;
         case GLFW_KEY_S:
             app->isPaused = !app->isPaused;
             if (!app->animationQueues.empty()) {
@@ -851,76 +1136,112 @@ void VulkanCube::mouseButtonCallback(GLFWwindow* window, int button, int action,
 
 void VulkanCube::cleanupSwapChain()
 {
-    vkDestroyImageView(device, depthImageView, nullptr);
-    vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthImageMemory, nullptr);
-
-    vkDestroyImageView(device, colorImageView, nullptr);
-    vkDestroyImage(device, colorImage, nullptr);
-    vkFreeMemory(device, colorImageMemory, nullptr);
-
-    for (auto framebuffer : swapChainFramebuffers) {
-        vkDestroyFramebuffer(device, framebuffer, nullptr);
-    }
+    destroyRenderTargets(renderTargets, false);
 
     for (auto imageView : swapChainImageViews) {
         vkDestroyImageView(device, imageView, nullptr);
     }
 
+    if (config.headless) {
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            vmaDestroyImage(allocator, swapChainImages[i], offscreenImageAllocations[i]);
+        }
+        swapChainImages.clear();
+        offscreenImageAllocations.clear();
+        return;
+    }
+
     vkDestroySwapchainKHR(device, swapChain, nullptr);
 }
 
 void VulkanCube::cleanup()
 {
+    finishCapture();
+    pollPipelines(true);
+    flushDeletionQueue();
+    if (pendingRenderTargets.valid()) {
+        RenderTargets targets = pendingRenderTargets.get();
+        destroyRenderTargets(targets, true);
+    }
+    for (auto& slot : captureSlots) {
+        if (slot.buffer != VK_NULL_HANDLE) {
+            vmaDestroyBuffer(allocator, slot.buffer, slot.allocation);
+        }
+    }
+
     cleanupSwapChain();
 
-    vkDestroyPipeline(device, trianglePipeline, nullptr);
-    vkDestroyPipeline(device, linePipeline, nullptr);
+    savePipelineCache();
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+    destroyPipelineLibraries(renderTargets);
+    vkDestroyPipeline(device, renderTargets.trianglePipeline, nullptr);
+    vkDestroyPipeline(device, renderTargets.massPipeline, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-    vkDestroyRenderPass(device, renderPass, nullptr);
+    vkDestroyPipelineLayout(device, massPipelineLayout, nullptr);
+    vkDestroyPipeline(device, foldPipeline, nullptr);
+    vkDestroyPipelineLayout(device, foldPipelineLayout, nullptr);
+    vkDestroyPipeline(device, cullPipeline, nullptr);
+    vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+    vkDestroyRenderPass(device, renderTargets.renderPass, nullptr);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-        vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-    }
+    gpuProfiler.reset();
+    commandRecorder.reset();
+    transferQueue.reset();
+
+    frameAllocator.reset();
 
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 
-    /*
-    vkDestroySampler(device, textureSampler, nullptr);
-    vkDestroyImageView(device, textureImageView, nullptr);
+    vkDestroyDescriptorPool(device, materialDescriptorPool, nullptr);
 
-    vkDestroyImage(device, textureImage, nullptr);
-    vkFreeMemory(device, textureImageMemory, nullptr);
-    */
+    vkDestroySampler(device, textureSampler, nullptr);
+    for (auto& texture : materialTextures) {
+        vkDestroyImageView(device, texture.view, nullptr);
+    }
+    materialTextures.clear();
+    vmaDestroyBuffer(allocator, materialBuffer, materialBufferAllocation);
 
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-
-    if (indexBufferMapperPtr != nullptr) {
-        vkUnmapMemory(device, indexBufferMemory);
-        indexBufferMapperPtr = nullptr;
+    vkDestroyDescriptorSetLayout(device, materialDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, massDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, foldDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, cullDescriptorSetLayout, nullptr);
+
+    // 持久映射的内存由 VMA 在销毁时自动解除映射
+    indexBufferMapperPtr = nullptr;
+    vmaDestroyBuffer(allocator, indexBuffer, indexBufferAllocation);
+
+    vertexBufferMappedPtr = nullptr;
+    vmaDestroyBuffer(allocator, vertexBuffer, vertexBufferAllocation);
+
+    vmaDestroyBuffer(allocator, colorBuffer, colorBufferAllocation);
+
+    vmaDestroyBuffer(allocator, massVertexBuffer, massVertexBufferAllocation);
+    vmaDestroyBuffer(allocator, massIndexBuffer, massIndexBufferAllocation);
+    vmaDestroyBuffer(allocator, massInstanceBuffer, massInstanceBufferAllocation);
+    vmaDestroyBuffer(allocator, massAnimationBuffer, massAnimationBufferAllocation);
+    for (size_t i = 0; i < massTransformBuffers.size(); i++) {
+        vmaDestroyBuffer(allocator, massTransformBuffers[i], massTransformAllocations[i]);
     }
-    vkDestroyBuffer(device, indexBuffer, nullptr);
-    vkFreeMemory(device, indexBufferMemory, nullptr);
-
-    if (vertexBufferMappedPtr != nullptr) {
-        vkUnmapMemory(device, vertexBufferMemory);
-        vertexBufferMappedPtr = nullptr;
+    for (size_t i = 0; i < massDrawBuffers.size(); i++) {
+        vmaDestroyBuffer(allocator, massDrawBuffers[i], massDrawAllocations[i]);
     }
 
-    vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
-
-    vkDestroyBuffer(device, colorBuffer, nullptr);
-    vkFreeMemory(device, colorBufferMemory, nullptr);
-
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
         vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
         vkDestroyFence(device, inFlightFences[i], nullptr);
     }
 
+    for (auto semaphore : foldFinishedSemaphores) {
+        vkDestroySemaphore(device, semaphore, nullptr);
+    }
+
     vkDestroyCommandPool(device, commandPool, nullptr);
+    vkDestroyCommandPool(device, computeCommandPool, nullptr);
+
+    vmaDestroyAllocator(allocator);
 
     vkDestroyDevice(device, nullptr);
 
@@ -928,37 +1249,136 @@ void VulkanCube::cleanup()
         DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
     }
 
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
 
-    glfwDestroyWindow(window);
+    if (window != nullptr) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 
-    glfwTerminate();
+    Tracer::getInstance().stop();
 }
 
 void VulkanCube::recreateSwapChain()
 {
+    TRACE_FUNCTION("vulkan");
     int width = 0, height = 0;
     glfwGetFramebufferSize(window, &width, &height);
-    while (width == 0 || height == 0) {
-        glfwGetFramebufferSize(window, &width, &height);
-        glfwWaitEvents();
+    if (width == 0 || height == 0) {
+        // 最小化时不重建, 窗口恢复后由下一次 present 的结果或 resize 回调再触发
+        framebufferResized = true;
+        return;
     }
 
-    vkDeviceWaitIdle(device);
-
-    cleanupSwapChain();
+    // 不等待设备空闲: 旧交换链作为 oldSwapchain 传给新交换链, 旧的视图、附件和帧缓冲交给延迟删除队列
+    retireSwapChain();
 
     createSwapChain();
     createImageViews();
-    createColorResources();
-    createDepthResources();
-    createFramebuffers();
-    initUBO();
+    ++swapChainGeneration;
+    renderTargets.extent = scaledExtent(renderTargets.scale);
+    createColorResources(renderTargets);
+    createDepthResources(renderTargets);
+    createFramebuffers(renderTargets, swapChainImageViews);
+
+    // 投影矩阵随宽高比变化; 帧常量每帧重新分配, 不会改写仍在被 GPU 读取的数据
+    resetUBO();
+}
+
+void VulkanCube::waitForFrameSlot()
+{
+    // 低延迟模式下 run 已经提前等待过, 再次调用时 fence 已触发, 各项回收都是幂等的
+    bool blocked = vkGetFenceStatus(device, inFlightFences[currentFrame]) == VK_NOT_READY;
+    {
+        ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::WaitFence);
+        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    }
+    framePacer.onFrameComplete(currentFrame, blocked);
+    collectGpuTimings();
+
+    completedSubmitSerial = std::max(completedSubmitSerial, inFlightSubmitSerials[currentFrame]);
+    collectRetiredResources();
+    transferQueue->collect();
+    collectCompletedCaptures(false);
+}
+
+void VulkanCube::applyFramePacing()
+{
+    uint32_t desired = framePacer.framesInFlight();
+    if (desired != framesInFlight) {
+        // 帧槽位会从 0 重新编号, 先让当前所有飞行帧完成; 只在策略切换时发生一次
+        vkWaitForFences(device, framesInFlight, inFlightFences.data(), VK_TRUE, UINT64_MAX);
+        completedSubmitSerial = submitSerial;
+        collectRetiredResources();
+        collectCompletedCaptures(true);
+        framesInFlight = desired;
+        currentFrame = 0;
+    }
+
+    if (!config.headless && chooseSwapPresentMode(querySwapChainSupport(physicalDevice).presentModes) != swapChainPresentMode) {
+        framebufferResized = true;
+    }
+}
+
+void VulkanCube::retireSwapChain()
+{
+    // 渲染通道和管线与交换链尺寸无关, 继续使用; 只退役附件和帧缓冲
+    deferDestroy([this, imageViews = swapChainImageViews, targets = renderTargets]() mutable {
+        destroyRenderTargets(targets, false);
+
+        for (auto imageView : imageViews) {
+            vkDestroyImageView(device, imageView, nullptr);
+        }
+    });
+
+    // fence 只覆盖渲染, 不覆盖呈现: 旧交换链最后一帧的 fence 触发时它的呈现可能还没结束. 再多保留一整轮飞行帧,
+    // 等新交换链上的帧也都渲染完成再销毁. 这仍然只是推测呈现已经结束; 要确知需要 VK_EXT_swapchain_maintenance1 的呈现 fence
+    deferDestroy([this, oldSwapChain = swapChain]() {
+        vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+    }, MAX_FRAMES_IN_FLIGHT);
+}
+
+void VulkanCube::deferDestroy(std::function<void()> destroy, uint64_t extraSubmits)
+{
+    // 队列按序号排序; 通常直接追加在末尾, 推迟更久的条目之后的条目插到它前面
+    uint64_t serial = submitSerial + extraSubmits;
+    auto position = deletionQueue.end();
+    while (position != deletionQueue.begin() && std::prev(position)->submitSerial > serial) {
+        --position;
+    }
+    deletionQueue.insert(position, { serial, std::move(destroy) });
+}
+
+void VulkanCube::collectRetiredResources()
+{
+    // 同一队列上的提交按顺序完成, 队首的资源最先可以释放
+    while (!deletionQueue.empty() && deletionQueue.front().submitSerial <= completedSubmitSerial) {
+        deletionQueue.front().destroy();
+        deletionQueue.pop_front();
+    }
+    if (frameAllocator) {
+        frameAllocator->collect(completedSubmitSerial);
+    }
+}
+
+void VulkanCube::flushDeletionQueue()
+{
+    vkDeviceWaitIdle(device);
+    completedSubmitSerial = submitSerial;
+    collectRetiredResources();
+    // 设备空闲, 推迟到以后的提交的条目也不再需要等待
+    while (!deletionQueue.empty()) {
+        deletionQueue.front().destroy();
+        deletionQueue.pop_front();
+    }
 }
 
 void VulkanCube::createInstance()
 {
+    TRACE_FUNCTION("vulkan");
     if (enableValidationLayers && !checkValidationLayerSupport()) {
         throw std::runtime_error("validation layers requested, but not available!");
     }
@@ -969,7 +1389,7 @@ void VulkanCube::createInstance()
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = VK_API_VERSION_1_1;
 
     VkInstanceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -1010,6 +1430,7 @@ void VulkanCube::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInf
 
 void VulkanCube::setupDebugMessenger()
 {
+    TRACE_FUNCTION("vulkan");
     if (!enableValidationLayers) return;
 
     VkDebugUtilsMessengerCreateInfoEXT createInfo;
@@ -1022,6 +1443,9 @@ void VulkanCube::setupDebugMessenger()
 
 void VulkanCube::createSurface()
 {
+    TRACE_FUNCTION("vulkan");
+    if (config.headless) return;
+
     if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
         throw std::runtime_error("failed to create window surface!");
     }
@@ -1029,6 +1453,7 @@ void VulkanCube::createSurface()
 
 void VulkanCube::pickPhysicalDevice()
 {
+    TRACE_FUNCTION("vulkan");
     uint32_t deviceCount = 0;
     vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
 
@@ -1042,7 +1467,7 @@ void VulkanCube::pickPhysicalDevice()
     for (const auto& device : devices) {
         if (isDeviceSuitable(device)) {
             physicalDevice = device;
-            msaaSamples = getMaxUsableSampleCount();
+            maxMsaaSamples = getMaxUsableSampleCount();
             break;
         }
     }
@@ -1054,10 +1479,17 @@ void VulkanCube::pickPhysicalDevice()
 
 void VulkanCube::createLogicalDevice()
 {
+    TRACE_FUNCTION("vulkan");
     QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = { queueFamilyIndices.graphicsFamily.value(), queueFamilyIndices.presentFamily.value() };
+    if (queueFamilyIndices.computeFamily.has_value()) {
+        uniqueQueueFamilies.insert(queueFamilyIndices.computeFamily.value());
+    }
+    if (queueFamilyIndices.transferFamily.has_value()) {
+        uniqueQueueFamilies.insert(queueFamilyIndices.transferFamily.value());
+    }
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -1069,9 +1501,14 @@ void VulkanCube::createLogicalDevice()
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance;
+
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
-    deviceFeatures.wideLines = VK_TRUE;
+    deviceFeatures.multiDrawIndirect = multiDrawIndirectSupported;
+    deviceFeatures.drawIndirectFirstInstance = multiDrawIndirectSupported;
 
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -1081,8 +1518,105 @@ void VulkanCube::createLogicalDevice()
 
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    auto extensions = getRequiredDeviceExtensions();
+    bool drawIndirectCountSupported = multiDrawIndirectSupported && isDeviceExtensionAvailable(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (drawIndirectCountSupported) {
+        extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+
+    // 可选的扩展功能: 设备支持的扩展都启用, 对应的功能结构串起来先查询, 再原样传给设备创建
+    void* featureChain = nullptr;
+    auto chainFeatures = [&featureChain](auto& features) {
+        features.pNext = featureChain;
+        featureChain = &features;
+    };
+
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures{};
+    pipelineLibraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+    bool pipelineLibraryAvailable = isDeviceExtensionAvailable(physicalDevice, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        isDeviceExtensionAvailable(physicalDevice, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+    if (pipelineLibraryAvailable) {
+        extensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+        extensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+        chainFeatures(pipelineLibraryFeatures);
+    }
+
+    // 动态渲染依赖 depth_stencil_resolve 和 create_renderpass2, 其余依赖在 Vulkan 1.1 中已是核心功能
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+    dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+    VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{};
+    synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+    bool dynamicRenderingAvailable = config.dynamicRendering &&
+        isDeviceExtensionAvailable(physicalDevice, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) &&
+        isDeviceExtensionAvailable(physicalDevice, VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME) &&
+        isDeviceExtensionAvailable(physicalDevice, VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME) &&
+        isDeviceExtensionAvailable(physicalDevice, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+    if (dynamicRenderingAvailable) {
+        extensions.push_back(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+        chainFeatures(dynamicRenderingFeatures);
+        chainFeatures(synchronization2Features);
+    }
+
+    // 材质的无绑定纹理数组; 不支持时材质集合只有一个纹理
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures{};
+    descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    bindlessMaterials = isDescriptorIndexingSupported(physicalDevice);
+    if (bindlessMaterials) {
+        extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        chainFeatures(descriptorIndexingFeatures);
+    }
+
+    if (featureChain != nullptr) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = featureChain;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+        createInfo.pNext = featureChain;
+    }
+
+    // 图形管线库: 不能快速链接的实现上分块编译没有好处, 按不支持处理
+    if (pipelineLibraryAvailable && pipelineLibraryFeatures.graphicsPipelineLibrary) {
+        VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT pipelineLibraryProperties{};
+        pipelineLibraryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &pipelineLibraryProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+        graphicsPipelineLibrarySupported = pipelineLibraryProperties.graphicsPipelineLibraryFastLinking;
+    }
+    if (graphicsPipelineLibrarySupported) {
+        spdlog::info("Using graphics pipeline libraries");
+    }
+    dynamicRendering = dynamicRenderingAvailable && dynamicRenderingFeatures.dynamicRendering && synchronization2Features.synchronization2;
+    spdlog::info("Rendering with {}", dynamicRendering ? "dynamic rendering" : "render pass objects");
+
+    // 组合图像采样器同时计入采样器和采样图像的限制
+    materialTextureCapacity = 1;
+    if (bindlessMaterials) {
+        VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties{};
+        descriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &descriptorIndexingProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+        materialTextureCapacity = std::min({ MassScene::s_maxMaterials,
+            descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+            descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+            descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+            descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSampledImages });
+    }
+    if (bindlessMaterials) {
+        spdlog::info("Using a bindless array of up to {} material textures", materialTextureCapacity);
+    }
+    else {
+        spdlog::warn("Descriptor indexing is not supported, all materials share one texture");
+    }
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     if (enableValidationLayers) {
         createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -1098,10 +1632,114 @@ void VulkanCube::createLogicalDevice()
 
     vkGetDeviceQueue(device, queueFamilyIndices.graphicsFamily.value(), 0, &graphicsQueue);
     vkGetDeviceQueue(device, queueFamilyIndices.presentFamily.value(), 0, &presentQueue);
+    std::set<uint32_t> sharedFamilies = { queueFamilyIndices.graphicsFamily.value() };
+    if (queueFamilyIndices.computeFamily.has_value()) {
+        vkGetDeviceQueue(device, queueFamilyIndices.computeFamily.value(), 0, &computeQueue);
+        sharedFamilies.insert(queueFamilyIndices.computeFamily.value());
+        spdlog::info("Using queue family {} for async compute", queueFamilyIndices.computeFamily.value());
+    }
+    if (queueFamilyIndices.transferFamily.has_value()) {
+        vkGetDeviceQueue(device, queueFamilyIndices.transferFamily.value(), 0, &dedicatedTransferQueue);
+        sharedFamilies.insert(queueFamilyIndices.transferFamily.value());
+        spdlog::info("Using queue family {} for uploads", queueFamilyIndices.transferFamily.value());
+    }
+    if (sharedFamilies.size() > 1) {
+        sharedQueueFamilies.assign(sharedFamilies.begin(), sharedFamilies.end());
+    }
+    if (drawIndirectCountSupported) {
+        cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+    }
+    if (dynamicRendering) {
+        cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR");
+        cmdEndRendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR");
+        cmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2KHR)vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR");
+    }
+}
+
+void VulkanCube::createAllocator()
+{
+    TRACE_FUNCTION("vulkan");
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    VmaAllocatorCreateInfo allocatorInfo{};
+    // Vulkan 1.1 起 dedicated allocation 成为核心功能, VMA 会根据驱动的 prefersDedicatedAllocation 提示决定是否独占分配
+    allocatorInfo.vulkanApiVersion = properties.apiVersion >= VK_API_VERSION_1_1 ? VK_API_VERSION_1_1 : VK_API_VERSION_1_0;
+    allocatorInfo.physicalDevice = physicalDevice;
+    allocatorInfo.device = device;
+    allocatorInfo.instance = instance;
+
+    if (vmaCreateAllocator(&allocatorInfo, &allocator) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create memory allocator!");
+    }
+}
+
+void VulkanCube::dumpAllocatorStats(bool detailed)
+{
+    VmaTotalStatistics stats{};
+    vmaCalculateStatistics(allocator, &stats);
+    const VmaStatistics& total = stats.total.statistics;
+    spdlog::info("GPU memory: {} allocations in {} device memory blocks, {:.2f} MiB used of {:.2f} MiB reserved",
+        total.allocationCount, total.blockCount,
+        total.allocationBytes / (1024.0 * 1024.0), total.blockBytes / (1024.0 * 1024.0));
+
+    if (!detailed) return;
+
+    char* statsString = nullptr;
+    vmaBuildStatsString(allocator, &statsString, VK_TRUE);
+    std::ofstream file(ALLOCATOR_STATS_PATH, std::ios::out | std::ios::trunc);
+    if (file.is_open()) {
+        file << statsString;
+        spdlog::info("Detailed allocator statistics written to {}", ALLOCATOR_STATS_PATH);
+    }
+    else {
+        spdlog::warn("Failed to open {} for writing", ALLOCATOR_STATS_PATH);
+    }
+    vmaFreeStatsString(allocator, statsString);
+}
+
+void VulkanCube::queryMemoryHeaps()
+{
+    TRACE_FUNCTION("vulkan");
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    bool allHeapsDeviceLocal = true;
+    for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++) {
+        const auto& heap = memProperties.memoryHeaps[i];
+        bool deviceLocal = (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+        allHeapsDeviceLocal = allHeapsDeviceLocal && deviceLocal;
+        spdlog::debug("Memory heap {}: {:.0f} MiB{}", i, heap.size / (1024.0 * 1024.0), deviceLocal ? " (device local)" : "");
+    }
+
+    // 没有 resizable BAR 时, 同时具备 DEVICE_LOCAL 和 HOST_VISIBLE 的内存通常只有 256 MiB 的窗口
+    constexpr VkDeviceSize s_smallBarSize = 256ull * 1024 * 1024;
+    bool resizableBar = false;
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        const auto& type = memProperties.memoryTypes[i];
+        constexpr VkMemoryPropertyFlags barFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        if ((type.propertyFlags & barFlags) == barFlags && memProperties.memoryHeaps[type.heapIndex].size > s_smallBarSize) {
+            resizableBar = true;
+        }
+    }
+
+    bool uma = properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU || properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU || allHeapsDeviceLocal;
+    directDeviceWrites = uma || resizableBar;
+
+    spdlog::info("Memory model: {}, uploads use {}", uma ? "unified" : (resizableBar ? "discrete with resizable BAR" : "discrete"),
+        directDeviceWrites ? "direct writes to device memory" : "staging buffers");
 }
 
 void VulkanCube::createSwapChain()
 {
+    TRACE_FUNCTION("vulkan");
+    if (config.headless) {
+        createOffscreenImages();
+        return;
+    }
+
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
     VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
@@ -1123,6 +1761,19 @@ void VulkanCube::createSwapChain()
     createInfo.imageExtent = extent;
     createInfo.imageArrayLayers = 1;
     createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    // 缩放渲染时交换链图像是放大拷贝的目标
+    if (swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) {
+        createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
+    if (!config.captureDirectory.empty()) {
+        if (swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) {
+            createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
+        else {
+            spdlog::warn("Swapchain images cannot be copied on this surface, frame capture disabled");
+            config.captureDirectory.clear();
+        }
+    }
 
     QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
     uint32_t queueFamilyIds[] = { queueFamilyIndices.graphicsFamily.value(), queueFamilyIndices.presentFamily.value() };
@@ -1139,7 +1790,10 @@ void VulkanCube::createSwapChain()
     createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
+    swapChainPresentMode = presentMode;
     createInfo.clipped = VK_TRUE;
+    // 重建时传入旧交换链, 驱动可以复用其资源, 旧交换链中已获取的图像仍可正常呈现
+    createInfo.oldSwapchain = swapChain;
 
     if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
         throw std::runtime_error("failed to create swap chain!");
@@ -1153,8 +1807,25 @@ void VulkanCube::createSwapChain()
     swapChainExtent = extent;
 }
 
+void VulkanCube::createOffscreenImages()
+{
+    swapChainImageFormat = findSupportedFormat({ VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB }, VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT);
+    swapChainExtent = { config.width, config.height };
+
+    // 每个飞行帧一张离屏图像, 与交换链图像一样作为 MSAA 的 resolve 目标
+    swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+    offscreenImageAllocations.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            swapChainImages[i], offscreenImageAllocations[i]);
+    }
+}
+
 void VulkanCube::createImageViews()
 {
+    TRACE_FUNCTION("vulkan");
     swapChainImageViews.resize(swapChainImages.size());
 
     for (uint32_t i = 0; i < swapChainImages.size(); i++) {
@@ -1164,19 +1835,34 @@ void VulkanCube::createImageViews()
 
 void VulkanCube::createRenderPass()
 {
+    TRACE_FUNCTION("vulkan");
+    depthFormat = findDepthFormat();
+    renderTargets.renderPass = buildRenderPass(renderTargets);
+}
+
+VkRenderPass VulkanCube::buildRenderPass(const RenderTargets& targets)
+{
+    // 动态渲染不需要渲染通道对象, 附件在 beginSceneRendering 中直接指定
+    if (dynamicRendering) return VK_NULL_HANDLE;
+
+    // 缩放渲染时输出到 sceneImage 再放大拷贝, 否则直接输出到交换链(或离屏)图像
+    bool upscale = targets.scale < 1.0f;
+    bool multisampled = targets.samples != VK_SAMPLE_COUNT_1_BIT;
+    VkImageLayout finalLayout = upscale || config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
     VkAttachmentDescription colorAttachment{};
-    colorAttachment.format = swapChainImageFormat;
-    colorAttachment.samples = msaaSamples;
+    colorAttachment.format = targets.format;
+    colorAttachment.samples = targets.samples;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.finalLayout = multisampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : finalLayout;
 
     VkAttachmentDescription depthAttachment{};
     depthAttachment.format = findDepthFormat();
-    depthAttachment.samples = msaaSamples;
+    depthAttachment.samples = targets.samples;
     depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -1185,14 +1871,14 @@ void VulkanCube::createRenderPass()
     depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentDescription colorAttachmentResolve{};
-    colorAttachmentResolve.format = swapChainImageFormat;
+    colorAttachmentResolve.format = targets.format;
     colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
     colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachmentResolve.finalLayout = finalLayout;
 
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
@@ -1206,42 +1892,58 @@ void VulkanCube::createRenderPass()
     colorAttachmentResolveRef.attachment = 2;
     colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    // 单采样时没有 resolve, 颜色附件就是最终图像
     VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
-    subpass.pResolveAttachments = &colorAttachmentResolveRef;
-
-    VkSubpassDependency dependency{};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-    dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-    std::array<VkAttachmentDescription, 3> attachments = { colorAttachment, depthAttachment, colorAttachmentResolve };
+    subpass.pResolveAttachments = multisampled ? &colorAttachmentResolveRef : nullptr;
+
+    // 上一帧可能还在用传输阶段读取 sceneImage, 写入前需要等待
+    std::array<VkSubpassDependency, 2> dependencies{};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    // 渲染结果随后会被放大拷贝或回读
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    std::vector<VkAttachmentDescription> attachments = { colorAttachment, depthAttachment };
+    if (multisampled) {
+        attachments.push_back(colorAttachmentResolve);
+    }
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
     renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
 
+    VkRenderPass renderPass;
     if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create render pass!");
     }
+    return renderPass;
 }
 
 void VulkanCube::createDescriptorSetLayout()
 {
+    TRACE_FUNCTION("vulkan");
     VkDescriptorSetLayoutBinding uboLayoutBinding{};
     uboLayoutBinding.binding = 0;
     uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     uboLayoutBinding.pImmutableSamplers = nullptr;
     uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
@@ -1254,160 +1956,495 @@ void VulkanCube::createDescriptorSetLayout()
     if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
         throw std::runtime_error("failed to create descriptor set layout!");
     }
+
+    // 材质单独放在 set 1, 可交互和大场景的管线共用: binding 0 是材质参数, binding 1 是所有材质的纹理.
+    // 长度可变的绑定必须是最后一个; 纹理数组按绑定后更新的 (更宽松的) 限制分配, 没写入的元素不被访问就不必有效.
+    // 不支持描述符索引时 binding 1 是普通的单个纹理, 在录制前 (该飞行帧的描述符集不在使用中) 更新
+    std::array<VkDescriptorSetLayoutBinding, 2> materialBindings{};
+    materialBindings[0].binding = 0;
+    materialBindings[0].descriptorCount = 1;
+    materialBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    materialBindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    materialBindings[1].binding = 1;
+    materialBindings[1].descriptorCount = materialTextureCapacity;
+    materialBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    materialBindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    std::array<VkDescriptorBindingFlagsEXT, 2> bindingFlags = { 0,
+        VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT };
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+    bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+    if (bindlessMaterials) {
+        layoutInfo.pNext = &bindingFlagsInfo;
+        layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    }
+    layoutInfo.bindingCount = static_cast<uint32_t>(materialBindings.size());
+    layoutInfo.pBindings = materialBindings.data();
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &materialDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create material descriptor set layout!");
+    }
 }
 
-void VulkanCube::createGraphicsPipeline()
+void VulkanCube::createPipelineCache()
 {
-    auto& glslCompiler = ShaderCompiler::getInstance();
-    auto vertShaderCode = glslCompiler.compileGLSL(std::filesystem::path("shaders/vert.glsl"), EShLangVertex);
-    auto fragShaderCode = glslCompiler.compileGLSL(std::filesystem::path("shaders/frag.glsl"), EShLangFragment);
-
-    VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+    TRACE_FUNCTION("vulkan");
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vertShaderModule;
-    vertShaderStageInfo.pName = "main";
+    std::vector<char> initialData;
+    std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        size_t fileSize = static_cast<size_t>(file.tellg());
+        PipelineCacheFileHeader header{};
+        file.seekg(0);
+        if (fileSize >= sizeof(header) && file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            bool valid = header.magic == s_pipelineCacheMagic && header.version == s_pipelineCacheVersion &&
+                header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+                header.driverVersion == properties.driverVersion &&
+                memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+                header.dataSize == fileSize - sizeof(header);
+            if (valid) {
+                initialData.resize(static_cast<size_t>(header.dataSize));
+                file.read(initialData.data(), initialData.size());
+                valid = file.good() && fnv1aHash(initialData.data(), initialData.size()) == header.dataHash;
+            }
 
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = fragShaderModule;
-    fragShaderStageInfo.pName = "main";
+            // 再校验驱动自身的缓存头, 防止驱动在 UUID 不变的情况下拒绝数据
+            if (valid) {
+                VkPipelineCacheHeaderVersionOne driverHeader{};
+                valid = initialData.size() >= sizeof(driverHeader);
+                if (valid) {
+                    memcpy(&driverHeader, initialData.data(), sizeof(driverHeader));
+                    valid = driverHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                        driverHeader.vendorID == properties.vendorID && driverHeader.deviceID == properties.deviceID &&
+                        memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+                }
+            }
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+            if (valid) {
+                pipelineCacheHit = true;
+                pipelineColdBuildUS = header.coldBuildTimeUS;
+            }
+            else {
+                initialData.clear();
+                spdlog::warn("Pipeline cache {} does not match this device or driver, ignoring it", PIPELINE_CACHE_PATH);
+            }
+        }
+        file.close();
+    }
 
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = initialData.size();
+    cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
 
-    auto bindingDescription = getBindingDescription();
-    auto attributeDescriptions = getAttributeDescriptions();
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+}
 
-    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescription.size());
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexBindingDescriptions = bindingDescription.data();
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+void VulkanCube::savePipelineCache()
+{
+    if (pipelineCache == VK_NULL_HANDLE) return;
 
-    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+        spdlog::warn("Failed to query pipeline cache data");
+        return;
+    }
+    std::vector<char> data(dataSize);
+    if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+        spdlog::warn("Failed to read pipeline cache data");
+        return;
+    }
+    data.resize(dataSize);
 
-    VkPipelineViewportStateCreateInfo viewportState{};
-    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportState.viewportCount = 1;
-    viewportState.scissorCount = 1;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-    VkPipelineRasterizationStateCreateInfo rasterizer{};
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 5.0f;
-    rasterizer.cullMode = VK_CULL_MODE_NONE;
-    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
+    PipelineCacheFileHeader header{};
+    header.magic = s_pipelineCacheMagic;
+    header.version = s_pipelineCacheVersion;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = data.size();
+    header.dataHash = fnv1aHash(data.data(), data.size());
+    header.coldBuildTimeUS = pipelineColdBuildUS;
+
+    // 先写临时文件再重命名, 保证进程中途退出时不会留下损坏的缓存
+    const std::string tmpPath = PIPELINE_CACHE_PATH + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            spdlog::warn("Failed to open {} for writing", tmpPath);
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), data.size());
+        file.flush();
+        if (!file.good()) {
+            spdlog::warn("Failed to write pipeline cache to {}", tmpPath);
+            return;
+        }
+    }
 
-    VkPipelineMultisampleStateCreateInfo multisampling{};
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = msaaSamples;
-
-    VkPipelineDepthStencilStateCreateInfo depthStencil{};
-    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencil.depthTestEnable = VK_TRUE;
-    depthStencil.depthWriteEnable = VK_TRUE;
-    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
-    depthStencil.depthBoundsTestEnable = VK_FALSE;
-    depthStencil.stencilTestEnable = VK_FALSE;
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, PIPELINE_CACHE_PATH, ec);
+    if (ec) {
+        spdlog::warn("Failed to replace pipeline cache {}: {}", PIPELINE_CACHE_PATH, ec.message());
+        std::filesystem::remove(tmpPath, ec);
+        return;
+    }
+    spdlog::debug("Saved {} bytes of pipeline cache to {}", data.size(), PIPELINE_CACHE_PATH);
+}
 
-    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
+std::vector<uint32_t> VulkanCube::compileFragmentShader()
+{
+    // 支持描述符索引时在 #version 之后插入宏, 选用无绑定的纹理数组; 源码随设备变化, 不经过 .spv 缓存
+    std::ifstream file("shaders/frag.glsl", std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open shaders/frag.glsl!");
+    }
+    std::string source(static_cast<size_t>(file.tellg()), ' ');
+    file.seekg(0);
+    file.read(&source[0], source.size());
+
+    if (bindlessMaterials) {
+        size_t version = source.find("#version");
+        size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+        if (lineEnd == std::string::npos) {
+            throw std::runtime_error("failed to find #version in shaders/frag.glsl!");
+        }
+        source.insert(lineEnd + 1, "#define BINDLESS_MATERIALS\n");
+    }
+    return ShaderCompiler::getInstance().compileGLSL(source, EShLangFragment);
+}
 
-    VkPipelineColorBlendStateCreateInfo colorBlending{};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.logicOp = VK_LOGIC_OP_COPY;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-    colorBlending.blendConstants[0] = 0.0f;
-    colorBlending.blendConstants[1] = 0.0f;
-    colorBlending.blendConstants[2] = 0.0f;
-    colorBlending.blendConstants[3] = 0.0f;
-
-    std::vector<VkDynamicState> dynamicStates = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR
-    };
+void VulkanCube::createGraphicsPipeline()
+{
+    TRACE_FUNCTION("vulkan");
+    // 保留 SPIR-V, 画质切换时在后台线程重建管线不必再经过着色器编译器
+    auto& glslCompiler = ShaderCompiler::getInstance();
+    vertShaderCode = glslCompiler.compileGLSL(std::filesystem::path("shaders/vert.glsl"), EShLangVertex);
+    fragShaderCode = compileFragmentShader();
 
-    VkPipelineDynamicStateCreateInfo dynamicState{};
-    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-    dynamicState.pDynamicStates = dynamicStates.data();
+    // 边框和选中描边在片元着色器里按面内坐标解析计算, 填充和描边在同一条管线里一次画完; 面的材质号在顶点着色器里读取
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(DrawConstants);
 
+    std::array<VkDescriptorSetLayout, 2> setLayouts = { descriptorSetLayout, materialDescriptorSetLayout };
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
         throw std::runtime_error("failed to create pipeline layout!");
     }
 
+    // 管线编译不阻塞初始化: 支持图形管线库时先分块编译并快速链接, 链接时优化的版本在后台完成后替换;
+    // 否则整条管线在后台线程创建, 与后续资源的创建重叠, 初始化结束前等待
+    if (graphicsPipelineLibrarySupported) {
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        buildPipelineLibraries(renderTargets);
+        uint64_t buildTimeUS = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - buildStart).count();
+        spdlog::info("Pipeline libraries built and fast-linked in {:.2f} ms", buildTimeUS / 1000.0);
+    }
+    requestPipelines(renderTargets);
+}
+
+void VulkanCube::buildPipelines(RenderTargets& targets)
+{
+    VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+
+    VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
+    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertShaderStageInfo.module = vertShaderModule;
+    vertShaderStageInfo.pName = "main";
+
+    VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
+    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragShaderStageInfo.module = fragShaderModule;
+    fragShaderStageInfo.pName = "main";
+
+    VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+
+    FixedFunctionState state(targets.samples, targets.format, depthFormat);
+    const void* renderingInfo = targets.renderPass == VK_NULL_HANDLE ? &state.renderingInfo : nullptr;
+
     VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext = renderingInfo;
     pipelineInfo.stageCount = 2;
     pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = &depthStencil;
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.pVertexInputState = &state.vertexInput;
+    pipelineInfo.pInputAssemblyState = &state.inputAssembly;
+    pipelineInfo.pViewportState = &state.viewport;
+    pipelineInfo.pRasterizationState = &state.rasterizer;
+    pipelineInfo.pMultisampleState = &state.multisampling;
+    pipelineInfo.pDepthStencilState = &state.depthStencil;
+    pipelineInfo.pColorBlendState = &state.colorBlending;
+    pipelineInfo.pDynamicState = &state.dynamicState;
     pipelineInfo.layout = pipelineLayout;
-    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.renderPass = targets.renderPass;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &trianglePipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &targets.trianglePipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &linePipeline) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create graphics pipeline!");
+    if (massPipelineLayout != VK_NULL_HANDLE) {
+        VkShaderModule massVertShaderModule = createShaderModule(massVertShaderCode);
+        shaderStages[0].module = massVertShaderModule;
+        state.useMassVertexInput(massPositions);
+        pipelineInfo.layout = massPipelineLayout;
+        VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &targets.massPipeline);
+        vkDestroyShaderModule(device, massVertShaderModule, nullptr);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create mass scene pipeline!");
+        }
     }
 
     vkDestroyShaderModule(device, fragShaderModule, nullptr);
     vkDestroyShaderModule(device, vertShaderModule, nullptr);
 }
 
-void VulkanCube::createFramebuffers()
+void VulkanCube::buildPipelineLibraries(RenderTargets& targets)
 {
-    swapChainFramebuffers.resize(swapChainImageViews.size());
+    VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+    VkShaderModule massVertShaderModule = massPipelineLayout != VK_NULL_HANDLE ? createShaderModule(massVertShaderCode) : VK_NULL_HANDLE;
+
+    FixedFunctionState state(targets.samples, targets.format, depthFormat);
+    const void* renderingInfo = targets.renderPass == VK_NULL_HANDLE ? &state.renderingInfo : nullptr;
+
+    // 每条管线四个库, 各自只带对应部分的状态; 着色器在这里编译, 链接时只做拼接
+    auto buildLibraries = [&](VkShaderModule vertModule, VkPipelineLayout layout) {
+        std::vector<VkPipeline> libraries;
+
+        VkGraphicsPipelineCreateInfo vertexInputInfo{};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        vertexInputInfo.pVertexInputState = &state.vertexInput;
+        vertexInputInfo.pInputAssemblyState = &state.inputAssembly;
+        libraries.push_back(createPipelineLibrary(VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT, vertexInputInfo));
+
+        VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertModule;
+        vertShaderStageInfo.pName = "main";
+
+        VkGraphicsPipelineCreateInfo preRasterizationInfo{};
+        preRasterizationInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        preRasterizationInfo.pNext = renderingInfo;
+        preRasterizationInfo.stageCount = 1;
+        preRasterizationInfo.pStages = &vertShaderStageInfo;
+        preRasterizationInfo.pViewportState = &state.viewport;
+        preRasterizationInfo.pRasterizationState = &state.rasterizer;
+        preRasterizationInfo.pDynamicState = &state.dynamicState;
+        preRasterizationInfo.layout = layout;
+        preRasterizationInfo.renderPass = targets.renderPass;
+        preRasterizationInfo.subpass = 0;
+        libraries.push_back(createPipelineLibrary(VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT, preRasterizationInfo));
+
+        VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
+        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragShaderStageInfo.module = fragShaderModule;
+        fragShaderStageInfo.pName = "main";
+
+        VkGraphicsPipelineCreateInfo fragmentShaderInfo{};
+        fragmentShaderInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        fragmentShaderInfo.pNext = renderingInfo;
+        fragmentShaderInfo.stageCount = 1;
+        fragmentShaderInfo.pStages = &fragShaderStageInfo;
+        fragmentShaderInfo.pMultisampleState = &state.multisampling;
+        fragmentShaderInfo.pDepthStencilState = &state.depthStencil;
+        fragmentShaderInfo.layout = layout;
+        fragmentShaderInfo.renderPass = targets.renderPass;
+        fragmentShaderInfo.subpass = 0;
+        libraries.push_back(createPipelineLibrary(VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT, fragmentShaderInfo));
+
+        VkGraphicsPipelineCreateInfo fragmentOutputInfo{};
+        fragmentOutputInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        fragmentOutputInfo.pNext = renderingInfo;
+        fragmentOutputInfo.pMultisampleState = &state.multisampling;
+        fragmentOutputInfo.pColorBlendState = &state.colorBlending;
+        fragmentOutputInfo.renderPass = targets.renderPass;
+        fragmentOutputInfo.subpass = 0;
+        libraries.push_back(createPipelineLibrary(VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT, fragmentOutputInfo));
+
+        return libraries;
+    };
 
-    for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-        std::array<VkImageView, 3> attachments = {
-            colorImageView,
-            depthImageView,
-            swapChainImageViews[i]
-        };
+    targets.triangleLibraries = buildLibraries(vertShaderModule, pipelineLayout);
+    if (massVertShaderModule != VK_NULL_HANDLE) {
+        state.useMassVertexInput(massPositions);
+        targets.massLibraries = buildLibraries(massVertShaderModule, massPipelineLayout);
+    }
+
+    vkDestroyShaderModule(device, massVertShaderModule, nullptr);
+    vkDestroyShaderModule(device, fragShaderModule, nullptr);
+    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+    // 快速链接不做跨阶段优化, 立即可用; 链接时优化的版本由 requestPipelines 在后台完成后替换
+    linkPipelines(targets, false);
+}
+
+VkPipeline VulkanCube::createPipelineLibrary(VkGraphicsPipelineLibraryFlagsEXT parts, VkGraphicsPipelineCreateInfo pipelineInfo)
+{
+    VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+    libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+    libraryInfo.flags = parts;
+    libraryInfo.pNext = pipelineInfo.pNext;
+
+    pipelineInfo.pNext = &libraryInfo;
+    pipelineInfo.flags |= VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+
+    VkPipeline library;
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &library) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create graphics pipeline library!");
+    }
+    return library;
+}
+
+void VulkanCube::linkPipelines(RenderTargets& targets, bool optimize)
+{
+    auto link = [this, optimize](const std::vector<VkPipeline>& libraries, VkPipelineLayout layout) {
+        VkPipelineLibraryCreateInfoKHR libraryInfo{};
+        libraryInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+        libraryInfo.libraryCount = static_cast<uint32_t>(libraries.size());
+        libraryInfo.pLibraries = libraries.data();
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.pNext = &libraryInfo;
+        pipelineInfo.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+        pipelineInfo.layout = layout;
+
+        VkPipeline pipeline;
+        if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to link graphics pipeline!");
+        }
+        return pipeline;
+    };
+
+    targets.trianglePipeline = link(targets.triangleLibraries, pipelineLayout);
+    if (!targets.massLibraries.empty()) {
+        targets.massPipeline = link(targets.massLibraries, massPipelineLayout);
+    }
+}
+
+void VulkanCube::destroyPipelineLibraries(RenderTargets& targets)
+{
+    for (auto library : targets.triangleLibraries) {
+        vkDestroyPipeline(device, library, nullptr);
+    }
+    for (auto library : targets.massLibraries) {
+        vkDestroyPipeline(device, library, nullptr);
+    }
+    targets.triangleLibraries.clear();
+    targets.massLibraries.clear();
+}
+
+void VulkanCube::requestPipelines(const RenderTargets& targets)
+{
+    RenderTargets snapshot;
+    snapshot.samples = targets.samples;
+    snapshot.format = targets.format;
+    snapshot.renderPass = targets.renderPass;
+    snapshot.triangleLibraries = targets.triangleLibraries;
+    snapshot.massLibraries = targets.massLibraries;
+
+    // 有管线库时做链接时优化, 否则整体创建; 主线程继续用当前的管线 (启动时则继续初始化其他资源), 完成后由 pollPipelines 替换
+    pendingPipelines = std::async(std::launch::async, [this, snapshot]() mutable {
+        TRACE_SCOPE("vulkan", "buildPipelines");
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        if (snapshot.triangleLibraries.empty()) {
+            buildPipelines(snapshot);
+        }
+        else {
+            linkPipelines(snapshot, true);
+        }
+
+        PipelineSet pipelines;
+        pipelines.trianglePipeline = snapshot.trianglePipeline;
+        pipelines.massPipeline = snapshot.massPipeline;
+        pipelines.buildTimeUS = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - buildStart).count();
+        return pipelines;
+    });
+}
+
+void VulkanCube::pollPipelines(bool wait)
+{
+    if (!pendingPipelines.valid()) return;
+    if (!wait && pendingPipelines.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+    PipelineSet pipelines = pendingPipelines.get();
+    if (!renderTargets.triangleLibraries.empty()) {
+        spdlog::info("Optimized pipelines linked in {:.2f} ms", pipelines.buildTimeUS / 1000.0);
+    }
+    else if (pipelineCacheHit) {
+        int64_t savedUS = static_cast<int64_t>(pipelineColdBuildUS) - static_cast<int64_t>(pipelines.buildTimeUS);
+        spdlog::info("Pipeline cache hit: pipelines built in {:.2f} ms, saved {:.2f} ms against a cold build",
+            pipelines.buildTimeUS / 1000.0, savedUS / 1000.0);
+    }
+    else {
+        pipelineColdBuildUS = pipelines.buildTimeUS;
+        spdlog::info("Pipeline cache miss: pipelines built in {:.2f} ms", pipelines.buildTimeUS / 1000.0);
+    }
+
+    // 被替换的快速链接管线可能还在飞行帧中使用
+    deferDestroy([this, trianglePipeline = renderTargets.trianglePipeline, massPipeline = renderTargets.massPipeline]() {
+        vkDestroyPipeline(device, trianglePipeline, nullptr);
+        vkDestroyPipeline(device, massPipeline, nullptr);
+    });
+    renderTargets.trianglePipeline = pipelines.trianglePipeline;
+    renderTargets.massPipeline = pipelines.massPipeline;
+}
+
+void VulkanCube::createFramebuffers(RenderTargets& targets, const std::vector<VkImageView>& imageViews)
+{
+    TRACE_FUNCTION("vulkan");
+    // 动态渲染直接使用图像视图, 交换链重建时只需要重建图像和视图
+    if (dynamicRendering) return;
+
+    targets.framebuffers.resize(imageViews.size());
+
+    for (size_t i = 0; i < imageViews.size(); i++) {
+        VkImageView outputView = targets.sceneImageView != VK_NULL_HANDLE ? targets.sceneImageView : imageViews[i];
+        std::vector<VkImageView> attachments;
+        if (targets.samples != VK_SAMPLE_COUNT_1_BIT) {
+            attachments = { targets.colorImageView, targets.depthImageView, outputView };
+        }
+        else {
+            attachments = { outputView, targets.depthImageView };
+        }
 
         VkFramebufferCreateInfo framebufferInfo{};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = renderPass;
+        framebufferInfo.renderPass = targets.renderPass;
         framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
         framebufferInfo.pAttachments = attachments.data();
-        framebufferInfo.width = swapChainExtent.width;
-        framebufferInfo.height = swapChainExtent.height;
+        framebufferInfo.width = targets.extent.width;
+        framebufferInfo.height = targets.extent.height;
         framebufferInfo.layers = 1;
 
-        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
+        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &targets.framebuffers[i]) != VK_SUCCESS) {
             throw std::runtime_error("failed to create framebuffer!");
         }
     }
@@ -1415,6 +2452,7 @@ void VulkanCube::createFramebuffers()
 
 void VulkanCube::createCommandPool()
 {
+    TRACE_FUNCTION("vulkan");
     QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
 
     VkCommandPoolCreateInfo poolInfo{};
@@ -1425,22 +2463,378 @@ void VulkanCube::createCommandPool()
     if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics command pool!");
     }
+
+    if (computeQueue != VK_NULL_HANDLE) {
+        poolInfo.queueFamilyIndex = queueFamilyIndices.computeFamily.value();
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &computeCommandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute command pool!");
+        }
+    }
+
+    // 没有专用传输队列时上传提交到图形队列, 同样不阻塞; 异步计算队列也读取上传的数据时多一个使用方
+    uint32_t uploadConsumers = computeQueue != VK_NULL_HANDLE && config.massSceneInstances > 0 ? 2 : 1;
+    if (dedicatedTransferQueue != VK_NULL_HANDLE) {
+        transferQueue = std::make_unique<TransferQueue>(device, allocator, dedicatedTransferQueue, queueFamilyIndices.transferFamily.value(), uploadConsumers);
+    }
+    else {
+        transferQueue = std::make_unique<TransferQueue>(device, allocator, graphicsQueue, queueFamilyIndices.graphicsFamily.value(), uploadConsumers);
+    }
+
+    if (config.massSceneInstances > 0) {
+        commandRecorder = std::make_unique<CommandRecorder>(device, queueFamilyIndices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT,
+            CommandRecorder::choosePartitionCount(config.recordThreads));
+    }
 }
 
-void VulkanCube::createColorResources()
+void VulkanCube::createColorResources(RenderTargets& targets)
 {
-    VkFormat colorFormat = swapChainImageFormat;
+    TRACE_FUNCTION("vulkan");
+    if (targets.samples != VK_SAMPLE_COUNT_1_BIT) {
+        createImage(targets.extent.width, targets.extent.height, 1, targets.samples, targets.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.colorImage, targets.colorImageAllocation);
+        targets.colorImageView = createImageView(targets.colorImage, targets.format, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
 
-    createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
-    colorImageView = createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    if (targets.scale < 1.0f) {
+        createImage(targets.extent.width, targets.extent.height, 1, VK_SAMPLE_COUNT_1_BIT, targets.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.sceneImage, targets.sceneImageAllocation);
+        targets.sceneImageView = createImageView(targets.sceneImage, targets.format, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
 }
 
-void VulkanCube::createDepthResources()
+void VulkanCube::createDepthResources(RenderTargets& targets)
 {
+    TRACE_FUNCTION("vulkan");
     VkFormat depthFormat = findDepthFormat();
 
-    createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-    depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+    createImage(targets.extent.width, targets.extent.height, 1, targets.samples, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.depthImage, targets.depthImageAllocation);
+    targets.depthImageView = createImageView(targets.depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+}
+
+void VulkanCube::destroyRenderTargets(RenderTargets& targets, bool passAndPipelines)
+{
+    for (auto framebuffer : targets.framebuffers) {
+        vkDestroyFramebuffer(device, framebuffer, nullptr);
+    }
+    targets.framebuffers.clear();
+
+    vkDestroyImageView(device, targets.sceneImageView, nullptr);
+    vmaDestroyImage(allocator, targets.sceneImage, targets.sceneImageAllocation);
+    vkDestroyImageView(device, targets.depthImageView, nullptr);
+    vmaDestroyImage(allocator, targets.depthImage, targets.depthImageAllocation);
+    vkDestroyImageView(device, targets.colorImageView, nullptr);
+    vmaDestroyImage(allocator, targets.colorImage, targets.colorImageAllocation);
+    targets.sceneImage = VK_NULL_HANDLE;
+    targets.sceneImageAllocation = VK_NULL_HANDLE;
+    targets.sceneImageView = VK_NULL_HANDLE;
+    targets.depthImage = VK_NULL_HANDLE;
+    targets.depthImageAllocation = VK_NULL_HANDLE;
+    targets.depthImageView = VK_NULL_HANDLE;
+    targets.colorImage = VK_NULL_HANDLE;
+    targets.colorImageAllocation = VK_NULL_HANDLE;
+    targets.colorImageView = VK_NULL_HANDLE;
+
+    if (passAndPipelines) {
+        destroyPipelineLibraries(targets);
+        vkDestroyPipeline(device, targets.trianglePipeline, nullptr);
+        vkDestroyPipeline(device, targets.massPipeline, nullptr);
+        vkDestroyRenderPass(device, targets.renderPass, nullptr);
+        targets.trianglePipeline = VK_NULL_HANDLE;
+        targets.massPipeline = VK_NULL_HANDLE;
+        targets.renderPass = VK_NULL_HANDLE;
+    }
+}
+
+VkExtent2D VulkanCube::scaledExtent(float scale) const
+{
+    return {
+        std::max(1u, static_cast<uint32_t>(swapChainExtent.width * scale)),
+        std::max(1u, static_cast<uint32_t>(swapChainExtent.height * scale))
+    };
+}
+
+void VulkanCube::createGpuProfiler()
+{
+    TRACE_FUNCTION("vulkan");
+    gpuProfiler = std::make_unique<GpuProfiler>(device, physicalDevice, findQueueFamilies(physicalDevice).graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT);
+}
+
+void VulkanCube::collectGpuTimings()
+{
+    double gpuMS = gpuProfiler->collect(currentFrame);
+    if (gpuMS >= 0.0 && qualityController && qualityController->onGpuFrameTime(gpuMS)) {
+        requestRenderTargets(qualityController->current());
+    }
+}
+
+void VulkanCube::dumpGpuProfile()
+{
+    if (!gpuProfiler->enabled()) return;
+
+    gpuProfiler->logSummary();
+    gpuProfiler->writeJson(config.gpuProfilePath.empty() ? GPU_PROFILE_PATH : config.gpuProfilePath);
+}
+
+void VulkanCube::createQualityController()
+{
+    TRACE_FUNCTION("vulkan");
+    renderTargets.samples = maxMsaaSamples;
+    renderTargets.scale = 1.0f;
+    renderTargets.format = swapChainImageFormat;
+    renderTargets.extent = swapChainExtent;
+
+    // 放大拷贝使用带线性过滤的 vkCmdBlitImage, 交换链图像还要能作为传输目标
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, swapChainImageFormat, &formatProperties);
+    VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    upscaleSupported = (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+    if (!config.headless) {
+        upscaleSupported = upscaleSupported &&
+            (querySwapChainSupport(physicalDevice).capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    }
+
+    // 离屏渲染默认保持固定画质, 只有显式给出目标帧时间时才调节
+    if (!config.adaptiveQuality || (config.headless && config.targetFrameTimeMS <= 0.0)) return;
+    if (!gpuProfiler->enabled()) {
+        spdlog::warn("Adaptive quality needs GPU timestamps, keeping {}x MSAA at full resolution", static_cast<uint32_t>(maxMsaaSamples));
+        return;
+    }
+
+    double target = config.targetFrameTimeMS > 0.0 ? config.targetFrameTimeMS : framePacer.refreshIntervalMS();
+    qualityController = std::make_unique<QualityController>(static_cast<uint32_t>(maxMsaaSamples), upscaleSupported, target);
+    spdlog::info("Adaptive quality: targeting {:.2f} ms of GPU time over {} levels{}", target, qualityController->levelCount(),
+        upscaleSupported ? "" : " (render scaling unsupported)");
+}
+
+void VulkanCube::requestRenderTargets(const QualityController::Level& level)
+{
+    RenderTargets targets;
+    targets.samples = static_cast<VkSampleCountFlagBits>(level.samples);
+    targets.scale = level.scale;
+    targets.format = swapChainImageFormat;
+    targets.extent = scaledExtent(level.scale);
+    targets.swapChainGeneration = swapChainGeneration;
+
+    // 渲染通道、管线(命中管线缓存)和附件都在后台线程创建, 帧循环不等待; 帧缓冲引用交换链视图, 留到主线程生效时创建
+    pendingRenderTargets = std::async(std::launch::async, [this, targets]() mutable {
+        TRACE_SCOPE("vulkan", "buildRenderTargets");
+        targets.renderPass = buildRenderPass(targets);
+        if (graphicsPipelineLibrarySupported) {
+            buildPipelineLibraries(targets);
+        }
+        else {
+            buildPipelines(targets);
+        }
+        createColorResources(targets);
+        createDepthResources(targets);
+        return targets;
+    });
+}
+
+void VulkanCube::pollRenderTargets()
+{
+    // 后台的链接时优化还在使用当前渲染目标的管线库, 完成之前不切换
+    if (pendingPipelines.valid()) return;
+    if (!pendingRenderTargets.valid() || pendingRenderTargets.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+    RenderTargets targets = pendingRenderTargets.get();
+    if (targets.swapChainGeneration != swapChainGeneration) {
+        // 构建期间交换链被重建过, 附件尺寸已经过时, 渲染通道和管线仍然可用; 这些附件还没有被 GPU 使用, 可以立即销毁
+        destroyRenderTargets(targets, false);
+        targets.extent = scaledExtent(targets.scale);
+        targets.swapChainGeneration = swapChainGeneration;
+        createColorResources(targets);
+        createDepthResources(targets);
+    }
+    createFramebuffers(targets, swapChainImageViews);
+
+    deferDestroy([this, old = renderTargets]() mutable {
+        destroyRenderTargets(old, true);
+    });
+    renderTargets = std::move(targets);
+    qualityController->onLevelApplied();
+    if (!renderTargets.triangleLibraries.empty()) {
+        requestPipelines(renderTargets);
+    }
+
+    spdlog::info("Adaptive quality: {}x MSAA at {:.0f}% render scale ({}x{})", static_cast<uint32_t>(renderTargets.samples),
+        renderTargets.scale * 100.0f, renderTargets.extent.width, renderTargets.extent.height);
+}
+
+void VulkanCube::beginSceneRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool secondaries)
+{
+    std::array<VkClearValue, 2> clearValues{};
+    clearValues[0].color = { {0.0f, 0.0f, 0.0f, 1.0f} };
+    clearValues[1].depthStencil = { 1.0f, 0 };
+
+    if (!dynamicRendering) {
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = renderTargets.renderPass;
+        renderPassInfo.framebuffer = renderTargets.framebuffers[imageIndex];
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = renderTargets.extent;
+        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+        return;
+    }
+
+    // 缩放渲染时输出到 sceneImage 再放大拷贝, 否则直接输出到交换链(或离屏)图像; 多重采样时输出图像是 resolve 目标
+    bool multisampled = renderTargets.samples != VK_SAMPLE_COUNT_1_BIT;
+    VkImage outputImage = renderTargets.sceneImage != VK_NULL_HANDLE ? renderTargets.sceneImage : swapChainImages[imageIndex];
+    VkImageView outputView = renderTargets.sceneImageView != VK_NULL_HANDLE ? renderTargets.sceneImageView : swapChainImageViews[imageIndex];
+
+    // 附件的内容每帧都清除或被 resolve 覆盖, 旧布局一律按 UNDEFINED 处理, 只需要等上一次使用结束
+    std::vector<VkImageMemoryBarrier2KHR> barriers;
+    VkImageMemoryBarrier2KHR barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+
+    // 输出图像上一次被放大拷贝或回读读取; 直接呈现的交换链图像只需接上获取信号量等待的阶段
+    barrier.image = outputImage;
+    if (renderTargets.sceneImage != VK_NULL_HANDLE || config.headless) {
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+    }
+    else {
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+    }
+    barriers.push_back(barrier);
+
+    // 多重采样颜色图像和深度图像只被上一帧的渲染写过
+    if (multisampled) {
+        barrier.image = renderTargets.colorImage;
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+        barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+        barriers.push_back(barrier);
+    }
+
+    barrier.image = renderTargets.depthImage;
+    barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (hasStencilComponent(depthFormat)) {
+        barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR;
+    barriers.push_back(barrier);
+
+    VkDependencyInfoKHR dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+    dependencyInfo.pImageMemoryBarriers = barriers.data();
+    cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+    // 多重采样的颜色在 resolve 之后不再需要, 不写回内存
+    VkRenderingAttachmentInfoKHR colorAttachment{};
+    colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+    colorAttachment.imageView = multisampled ? renderTargets.colorImageView : outputView;
+    colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.clearValue = clearValues[0];
+    if (multisampled) {
+        colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT_KHR;
+        colorAttachment.resolveImageView = outputView;
+        colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+
+    VkRenderingAttachmentInfoKHR depthAttachment{};
+    depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+    depthAttachment.imageView = renderTargets.depthImageView;
+    depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.clearValue = clearValues[1];
+
+    VkRenderingInfoKHR renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+    renderingInfo.flags = secondaries ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR : 0;
+    renderingInfo.renderArea.extent = renderTargets.extent;
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachment;
+    renderingInfo.pDepthAttachment = &depthAttachment;
+    cmdBeginRendering(commandBuffer, &renderingInfo);
+}
+
+void VulkanCube::endSceneRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    if (!dynamicRendering) {
+        vkCmdEndRenderPass(commandBuffer);
+        return;
+    }
+    cmdEndRendering(commandBuffer);
+
+    // 与渲染通道的 finalLayout 一致: 随后被放大拷贝或回读的图像转为传输源, 直接呈现的交换链图像转为呈现布局,
+    // 呈现之前的等待由渲染完成信号量保证
+    bool transferSource = renderTargets.sceneImage != VK_NULL_HANDLE || config.headless;
+    VkImageMemoryBarrier2KHR barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+    barrier.dstStageMask = transferSource ? VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR : VK_PIPELINE_STAGE_2_NONE_KHR;
+    barrier.dstAccessMask = transferSource ? VK_ACCESS_2_TRANSFER_READ_BIT_KHR : VK_ACCESS_2_NONE_KHR;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.newLayout = transferSource ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = renderTargets.sceneImage != VK_NULL_HANDLE ? renderTargets.sceneImage : swapChainImages[imageIndex];
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+
+    VkDependencyInfoKHR dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &barrier;
+    cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+void VulkanCube::recordUpscale(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    // sceneImage 已由渲染通道转换为 TRANSFER_SRC_OPTIMAL, 线性过滤放大到交换链图像
+    VkImageLayout finalLayout = config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = swapChainImages[imageIndex];
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkImageBlit blit{};
+    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.layerCount = 1;
+    blit.srcOffsets[1] = { static_cast<int32_t>(renderTargets.extent.width), static_cast<int32_t>(renderTargets.extent.height), 1 };
+    blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.dstSubresource.layerCount = 1;
+    blit.dstOffsets[1] = { static_cast<int32_t>(swapChainExtent.width), static_cast<int32_t>(swapChainExtent.height), 1 };
+    vkCmdBlitImage(commandBuffer, renderTargets.sceneImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = finalLayout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
 }
 
 VkFormat VulkanCube::findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
@@ -1469,131 +2863,115 @@ VkFormat VulkanCube::findDepthFormat()
     );
 }
 
-/*
-void VulkanCube::createTextureImage()
+void VulkanCube::createMaterials()
 {
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-    mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+    TRACE_FUNCTION("assets");
+    std::vector<TextureSource> sources;
+    for (const auto& path : config.texturePaths) {
+        if (sources.size() == materialTextureCapacity) {
+            spdlog::warn("At most {} textures are supported, ignoring {}", materialTextureCapacity, path);
+            continue;
+        }
+        try {
+            sources.push_back(TextureStreamer::loadKtx2(path));
+        }
+        catch (const std::exception& e) {
+            spdlog::warn("Failed to load texture {}: {}, using a white texture", path, e.what());
+            sources.push_back(TextureStreamer::whiteTexture());
+        }
 
-    if (!pixels) {
-        throw std::runtime_error("failed to load texture image!");
+        // 块压缩等格式不一定能采样, 不支持时退回白色纹理
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, sources.back().format, &formatProperties);
+        VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if ((formatProperties.optimalTilingFeatures & required) != required) {
+            spdlog::warn("Texture format {} of {} cannot be sampled with linear filtering, using a white texture", static_cast<int>(sources.back().format), path);
+            sources.back() = TextureStreamer::whiteTexture();
+        }
+    }
+    if (sources.empty()) {
+        sources.push_back(TextureStreamer::whiteTexture());
     }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
-
-    stbi_image_free(pixels);
-
-    createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-    copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-    //transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    // 每个纹理一种材质; 图像在传输队列上写入, 在图形和异步计算队列族上采样
+    for (auto& source : sources) {
+        MaterialTexture texture;
+        texture.streamer = std::make_unique<TextureStreamer>(device, allocator, sharedQueueFamilies, std::move(source));
+        texture.streamer->uploadInitial(*transferQueue, s_textureInitialBudget);
+        createMaterialTextureView(texture);
+
+        Material material;
+        material.textureIndex = static_cast<uint32_t>(materialTextures.size());
+        materials.push_back(material);
+        materialTextures.push_back(std::move(texture));
+    }
+    spdlog::info("Created {} materials", materials.size());
 
-    generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels);
+    VkDeviceSize bufferSize = sizeof(materials[0]) * materials.size();
+    void* materialMapped = nullptr;
+    createDeviceBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, materialBuffer, materialBufferAllocation, &materialMapped);
+    writeBuffer(materialBuffer, materialBufferAllocation, materialMapped, 0, materials.data(), bufferSize);
 }
-*/
 
-/*
-void VulkanCube::generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+void VulkanCube::createMaterialTextureView(MaterialTexture& texture)
 {
-    // Check if image format supports linear blitting
-    VkFormatProperties formatProperties;
-    vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
+    uint32_t residentLevel = texture.streamer->residentLevel();
+    texture.view = createImageView(texture.streamer->image(), texture.streamer->format(), VK_IMAGE_ASPECT_COLOR_BIT,
+        texture.streamer->levelCount() - residentLevel, residentLevel);
+    ++texture.generation;
+}
 
-    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-        throw std::runtime_error("texture image format does not support linear blitting!");
+void VulkanCube::streamTextures()
+{
+    for (auto& texture : materialTextures) {
+        if (texture.streamer->updateResidency(*transferQueue)) {
+            // 旧视图可能还被在飞行的帧的描述符集引用
+            deferDestroy([this, view = texture.view]() {
+                vkDestroyImageView(device, view, nullptr);
+            });
+            createMaterialTextureView(texture);
+        }
     }
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.image = image;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
-
-    int32_t mipWidth = texWidth;
-    int32_t mipHeight = texHeight;
-
-    for (uint32_t i = 1; i < mipLevels; i++) {
-        barrier.subresourceRange.baseMipLevel = i - 1;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-        vkCmdPipelineBarrier(commandBuffer,
-            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
-            0, nullptr,
-            0, nullptr,
-            1, &barrier);
-
-        VkImageBlit blit{};
-        blit.srcOffsets[0] = { 0, 0, 0 };
-        blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
-        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.srcSubresource.mipLevel = i - 1;
-        blit.srcSubresource.baseArrayLayer = 0;
-        blit.srcSubresource.layerCount = 1;
-        blit.dstOffsets[0] = { 0, 0, 0 };
-        blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 };
-        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.dstSubresource.mipLevel = i;
-        blit.dstSubresource.baseArrayLayer = 0;
-        blit.dstSubresource.layerCount = 1;
-
-        vkCmdBlitImage(commandBuffer,
-            image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1, &blit,
-            VK_FILTER_LINEAR);
-
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        vkCmdPipelineBarrier(commandBuffer,
-            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-            0, nullptr,
-            0, nullptr,
-            1, &barrier);
-
-        if (mipWidth > 1) mipWidth /= 2;
-        if (mipHeight > 1) mipHeight /= 2;
+    // 纹理逐个流送, 同一时间只有一个后台批次, 每帧的上传量不随纹理数增加
+    for (auto& texture : materialTextures) {
+        if (texture.streamer->streaming()) {
+            texture.streamer->stream(*transferQueue, s_textureStreamBudget);
+            break;
+        }
     }
+}
 
-    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+void VulkanCube::updateMaterialDescriptorSet(uint32_t frameIndex)
+{
+    auto& generations = materialDescriptorGenerations[frameIndex];
+    std::vector<VkDescriptorImageInfo> imageInfos;
+    imageInfos.reserve(materialTextures.size());
+    std::vector<VkWriteDescriptorSet> descriptorWrites;
+    for (uint32_t index = 0; index < materialTextures.size(); ++index) {
+        if (generations[index] == materialTextures[index].generation) continue;
 
-    vkCmdPipelineBarrier(commandBuffer,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier);
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = materialTextures[index].view;
+        imageInfo.sampler = textureSampler;
+        imageInfos.push_back(imageInfo);
 
-    endSingleTimeCommands(commandBuffer);
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = materialDescriptorSets[frameIndex];
+        descriptorWrite.dstBinding = 1;
+        descriptorWrite.dstArrayElement = index;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &imageInfos.back();
+        descriptorWrites.push_back(descriptorWrite);
+        generations[index] = materialTextures[index].generation;
+    }
+    if (!descriptorWrites.empty()) {
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
 }
-*/
 
 VkSampleCountFlagBits VulkanCube::getMaxUsableSampleCount()
 {
@@ -1611,7 +2989,6 @@ VkSampleCountFlagBits VulkanCube::getMaxUsableSampleCount()
     return VK_SAMPLE_COUNT_1_BIT;
 }
 
-/*
 void VulkanCube::createTextureSampler()
 {
     VkPhysicalDeviceProperties properties{};
@@ -1639,9 +3016,8 @@ void VulkanCube::createTextureSampler()
         throw std::runtime_error("failed to create texture sampler!");
     }
 }
-*/
 
-VkImageView VulkanCube::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
+VkImageView VulkanCube::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel)
 {
     VkImageViewCreateInfo viewInfo{};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1649,7 +3025,7 @@ VkImageView VulkanCube::createImageView(VkImage image, VkFormat format, VkImageA
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = aspectFlags;
-    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
     viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
@@ -1662,7 +3038,7 @@ VkImageView VulkanCube::createImageView(VkImage image, VkFormat format, VkImageA
     return imageView;
 }
 
-void VulkanCube::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+void VulkanCube::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VmaAllocation& imageAllocation)
 {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1679,23 +3055,20 @@ void VulkanCube::createImage(uint32_t width, uint32_t height, uint32_t mipLevels
     imageInfo.samples = numSamples;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create image!");
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_UNKNOWN;
+    allocCreateInfo.requiredFlags = properties;
+    if (usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+        // 渲染目标体积大且随窗口大小重建, 独占分配可以避免在共享块里留下碎片
+        allocCreateInfo.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
     }
-
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(device, image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
+    if (usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) {
+        allocCreateInfo.preferredFlags |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
     }
 
-    vkBindImageMemory(device, image, imageMemory, 0);
+    if (vmaCreateImage(allocator, &imageInfo, &allocCreateInfo, &image, &imageAllocation, nullptr) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create image!");
+    }
 }
 
 void VulkanCube::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
@@ -1749,30 +3122,6 @@ void VulkanCube::transitionImageLayout(VkImage image, VkFormat format, VkImageLa
 }
 
 /*
-void VulkanCube::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
-{
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = { 0, 0, 0 };
-    region.imageExtent = {
-        width,
-        height,
-        1
-    };
-
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    endSingleTimeCommands(commandBuffer);
-}
-
 void VulkanCube::loadModel()
 {
     tinyobj::attrib_t attrib;
@@ -1797,221 +3146,954 @@ void VulkanCube::loadModel()
                 attrib.vertices[3 * index.vertex_index + 2]
             };
 
-            vertex.texCoord = {
-                attrib.texcoords[2 * index.texcoord_index + 0],
-                1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-            };
+            vertex.texCoord = {
+                attrib.texcoords[2 * index.texcoord_index + 0],
+                1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+            };
+
+            vertex.color = { 1.0f, 1.0f, 1.0f };
+
+            if (uniqueVertices.count(vertex) == 0) {
+                uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+                vertices.push_back(vertex);
+            }
+
+            indices.push_back(uniqueVertices[vertex]);
+        }
+    }
+}
+*/
+
+void VulkanCube::createVertexBuffer()
+{
+    TRACE_FUNCTION("vulkan");
+    vertices = s_netVertices;
+
+    VkDeviceSize vertexBufferSize = sizeof(vertices[0]) * vertices.size();
+    createDeviceBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferAllocation, &vertexBufferMappedPtr);
+    writeBuffer(vertexBuffer, vertexBufferAllocation, vertexBufferMappedPtr, 0, vertices.data(), vertexBufferSize);
+
+    color = {
+        glm::vec3(0.8f, 0.8f, 0.0f), // f
+        glm::vec3(0.0f, 0.8f, 0.8f), // f
+        glm::vec3(0.8f, 0.0f, 0.8f), // f
+        glm::vec3(0.8f, 0.3f, 0.0f), // f
+        glm::vec3(0.0f, 0.8f, 0.0f), // f
+        glm::vec3(0.0f, 0.0f, 0.8f), // f
+    };
+
+    // 每个面一种颜色, 面的 4 个顶点各存一份, 打包成 RGBA8; 6 个面一次绘制
+    std::vector<uint32_t> packedColors;
+    for (const auto& c : color) {
+        packedColors.insert(packedColors.end(), 4, packColor(glm::vec4(c, 1.f)));
+    }
+    VkDeviceSize colorBufferSize = sizeof(packedColors[0]) * packedColors.size();
+    void* colorMapped = nullptr;
+    createDeviceBuffer(colorBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, colorBuffer, colorBufferAllocation, &colorMapped);
+    writeBuffer(colorBuffer, colorBufferAllocation, colorMapped, 0, packedColors.data(), colorBufferSize);
+}
+
+void VulkanCube::createIndexBuffer()
+{
+    TRACE_FUNCTION("vulkan");
+    indices = s_netIndices;
+    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    createDeviceBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferAllocation, &indexBufferMapperPtr);
+    writeBuffer(indexBuffer, indexBufferAllocation, indexBufferMapperPtr, 0, indices.data(), bufferSize);
+}
+
+void VulkanCube::createFrameAllocator()
+{
+    TRACE_FUNCTION("vulkan");
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    // 每次分配按动态偏移的要求对齐; 显存对 CPU 可见时放在显存里, 着色器读取不经过 PCIe
+    VkMemoryPropertyFlags preferred = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (directDeviceWrites) {
+        preferred |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    }
+    frameAllocator = std::make_unique<FrameAllocator>(allocator, s_frameAllocatorFrameBytes * MAX_FRAMES_IN_FLIGHT,
+        properties.limits.minUniformBufferOffsetAlignment, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, preferred);
+}
+
+void VulkanCube::createMassSceneLayout()
+{
+    if (config.massSceneInstances == 0) return;
+
+    TRACE_FUNCTION("vulkan");
+    massVertShaderCode = ShaderCompiler::getInstance().compileGLSL(std::filesystem::path("shaders/mass_vert.glsl"), EShLangVertex);
+    auto vertexFormatSupported = [this](VkFormat format) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+        return (properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) != 0;
+    };
+    // 管线的顶点输入格式取决于打包结果, 所以在创建管线之前打包; extent 是顶点到原点的最大距离
+    float meshExtent = 0.f;
+    auto packMesh = [&](const Mesh& mesh) {
+        std::vector<glm::vec4> positions;
+        positions.reserve(mesh.vertices.size());
+        for (const auto& vertex : mesh.vertices) {
+            meshExtent = std::max(meshExtent, glm::length(vertex.position));
+            positions.push_back(glm::vec4(vertex.position, static_cast<float>(vertex.face)));
+        }
+        massPositions = packPositions(positions, vertexFormatSupported);
+        massIndices = MeshImport::packIndices(mesh);
+    };
+
+    if (config.meshPath.empty()) {
+        // 默认的展开图也经过同样的去重和重排, 顶点的面号随顶点一起存储, 不再依赖顶点顺序
+        std::vector<MeshVertex> triangleVertices;
+        for (uint16_t index : s_netIndices) {
+            triangleVertices.push_back(MeshVertex{ s_netVertices[index], index / 4u });
+        }
+        Mesh mesh = MeshImport::deduplicate(triangleVertices);
+        MeshImport::optimize(mesh);
+        packMesh(mesh);
+    }
+    else {
+        // 缓存按源文件内容的哈希命名; 缓存里的顶点格式当前设备不支持时也重新导入
+        uint64_t sourceHash = MeshCache::hashFile(config.meshPath);
+        std::filesystem::path cachePath = MeshCache::cachePath(MESH_CACHE_DIRECTORY, sourceHash);
+        massMeshCache = MeshCache::open(cachePath, sourceHash);
+        if (massMeshCache && !vertexFormatSupported(static_cast<VkFormat>(massMeshCache->header().vertexFormat))) {
+            massMeshCache.reset();
+        }
+
+        if (massMeshCache) {
+            const MeshCache::Header& header = massMeshCache->header();
+            massPositions.format = static_cast<VkFormat>(header.vertexFormat);
+            massPositions.stride = header.vertexStride;
+            massPositions.scale = glm::vec4(header.positionScale[0], header.positionScale[1], header.positionScale[2], header.positionScale[3]);
+            massPositions.offset = glm::vec4(header.positionOffset[0], header.positionOffset[1], header.positionOffset[2], header.positionOffset[3]);
+            massIndices.type = static_cast<VkIndexType>(header.indexType);
+            massIndices.count = header.indexCount;
+            meshExtent = header.extent;
+            spdlog::info("Loaded {} from mesh cache {}", config.meshPath, cachePath.string());
+        }
+        else {
+            packMesh(MeshImport::loadObj(config.meshPath, netFaceAt));
+            try {
+                MeshCache::write(cachePath, sourceHash, massPositions, massIndices, meshExtent);
+            }
+            catch (const std::exception& e) {
+                spdlog::warn("Mesh cache not written: {}", e.what());
+            }
+        }
+    }
+
+    // 包围球半径按网格相对展开图的大小放大
+    float netExtent = 0.f;
+    for (const auto& vertex : s_netVertices) {
+        netExtent = std::max(netExtent, glm::length(vertex));
+    }
+    massBoundingRadius = MassScene::s_boundingRadius * std::max(1.f, meshExtent / netExtent);
+    uint32_t vertexCount = massMeshCache ? massMeshCache->header().vertexCount : static_cast<uint32_t>(massPositions.data.size() / massPositions.stride);
+    spdlog::info("Mass scene mesh: {} vertices packed as {} ({} bytes per vertex), {} {}-bit indices", vertexCount,
+        vertexFormatName(massPositions.format), massPositions.stride, massIndices.count, massIndices.type == VK_INDEX_TYPE_UINT16 ? 16 : 32);
+    if (massPositions.format == VK_FORMAT_R16G16B16A16_SNORM) {
+        spdlog::info("Mass scene mesh positions quantised to the bounding box around ({:.3f}, {:.3f}, {:.3f}), half extents ({:.3f}, {:.3f}, {:.3f})",
+            massPositions.offset.x, massPositions.offset.y, massPositions.offset.z, massPositions.scale.x, massPositions.scale.y, massPositions.scale.z);
+    }
+
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+    for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+        bindings[binding].binding = binding;
+        bindings[binding].descriptorCount = 1;
+        bindings[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[binding].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &massDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create mass scene descriptor set layout!");
+    }
+
+    // 与交互场景共用片元着色器, 推送常量范围也相同
+    VkPushConstantRange drawConstantRange{};
+    drawConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    drawConstantRange.offset = 0;
+    drawConstantRange.size = sizeof(DrawConstants);
+
+    std::array<VkDescriptorSetLayout, 2> setLayouts = { massDescriptorSetLayout, materialDescriptorSetLayout };
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &drawConstantRange;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &massPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create mass scene pipeline layout!");
+    }
+
+    // 折叠计算管线: 读取动画参数, 写出面变换; 时间和实例数通过推送常量传入
+    std::array<VkDescriptorSetLayoutBinding, 2> foldBindings{};
+    for (uint32_t binding = 0; binding < foldBindings.size(); ++binding) {
+        foldBindings[binding].binding = binding;
+        foldBindings[binding].descriptorCount = 1;
+        foldBindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        foldBindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    layoutInfo.bindingCount = static_cast<uint32_t>(foldBindings.size());
+    layoutInfo.pBindings = foldBindings.data();
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &foldDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create fold descriptor set layout!");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(float) + sizeof(uint32_t);
+
+    pipelineLayoutInfo.pSetLayouts = &foldDescriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &foldPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create fold pipeline layout!");
+    }
+
+    foldPipeline = createComputePipeline("shaders/fold.comp", foldPipelineLayout);
+
+    // 剔除需要多重间接绘制和非零 firstInstance; 不支持时退回到绘制全部实例
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    massCulling = multiDrawIndirectSupported && properties.limits.maxDrawIndirectCount >= config.massSceneInstances;
+    if (!massCulling) {
+        spdlog::warn("Multi-draw indirect is not available, mass scene culling disabled");
+        return;
+    }
+
+    // 剔除计算管线: 读取帧常量和实例数据, 把可见实例的绘制命令追加到间接绘制缓冲区; 模型矩阵通过推送常量传入
+    std::array<VkDescriptorSetLayoutBinding, 3> cullBindings{};
+    for (uint32_t binding = 0; binding < cullBindings.size(); ++binding) {
+        cullBindings[binding].binding = binding;
+        cullBindings[binding].descriptorCount = 1;
+        cullBindings[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        cullBindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    layoutInfo.bindingCount = static_cast<uint32_t>(cullBindings.size());
+    layoutInfo.pBindings = cullBindings.data();
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &cullDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create cull descriptor set layout!");
+    }
+
+    pushConstantRange.size = sizeof(glm::mat4) + sizeof(uint32_t) * 3 + sizeof(float);
+    pipelineLayoutInfo.pSetLayouts = &cullDescriptorSetLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create cull pipeline layout!");
+    }
+
+    cullPipeline = createComputePipeline("shaders/cull.comp", cullPipelineLayout);
+    spdlog::info("Mass scene culling draws with {}", cmdDrawIndexedIndirectCount ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndexedIndirect");
+}
+
+VkPipeline VulkanCube::createComputePipeline(const std::filesystem::path& source, VkPipelineLayout layout)
+{
+    auto shaderCode = ShaderCompiler::getInstance().compileGLSL(source, EShLangCompute);
+    VkShaderModule shaderModule = createShaderModule(shaderCode);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = layout;
+    VkPipeline pipeline;
+    VkResult result = vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
+    vkDestroyShaderModule(device, shaderModule, nullptr);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline!");
+    }
+    return pipeline;
+}
+
+void VulkanCube::createMassSceneBuffers()
+{
+    if (config.massSceneInstances == 0) return;
+
+    TRACE_FUNCTION("vulkan");
+    massScene = std::make_unique<MassScene>(config.massSceneInstances, color, static_cast<uint32_t>(materials.size()));
+    massSceneStart = animationNow();
+
+    // 单个展开图的顶点缓冲区会被动画改写, 实例共享的是一份未变形的几何, 已在 createMassSceneLayout 中打包或映射
+    const void* vertexData = massMeshCache ? massMeshCache->vertexData() : massPositions.data.data();
+    VkDeviceSize vertexBufferSize = massMeshCache ? massMeshCache->header().vertexSize : massPositions.data.size();
+    void* vertexMapped = nullptr;
+    createDeviceBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, massVertexBuffer, massVertexBufferAllocation, &vertexMapped);
+    writeBuffer(massVertexBuffer, massVertexBufferAllocation, vertexMapped, 0, vertexData, vertexBufferSize);
+
+    const void* indexData = massMeshCache ? massMeshCache->indexData() : massIndices.data.data();
+    VkDeviceSize indexBufferSize = massMeshCache ? massMeshCache->header().indexSize : massIndices.data.size();
+    void* indexMapped = nullptr;
+    createDeviceBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, massIndexBuffer, massIndexBufferAllocation, &indexMapped);
+    writeBuffer(massIndexBuffer, massIndexBufferAllocation, indexMapped, 0, indexData, indexBufferSize);
+    // writeBuffer 已经复制了数据, 之后只用到格式和数量
+    massPositions.data = {};
+    massIndices.data = {};
+    massMeshCache.reset();
+
+    const auto& instances = massScene->instances();
+    VkDeviceSize instanceBufferSize = sizeof(instances[0]) * instances.size();
+    void* instanceMapped = nullptr;
+    createDeviceBuffer(instanceBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, massInstanceBuffer, massInstanceBufferAllocation, &instanceMapped);
+    writeBuffer(massInstanceBuffer, massInstanceBufferAllocation, instanceMapped, 0, instances.data(), instanceBufferSize);
+
+    const auto& animations = massScene->animations();
+    VkDeviceSize animationBufferSize = sizeof(animations[0]) * animations.size();
+    void* animationMapped = nullptr;
+    createDeviceBuffer(animationBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, massAnimationBuffer, massAnimationBufferAllocation, &animationMapped, true);
+    writeBuffer(massAnimationBuffer, massAnimationBufferAllocation, animationMapped, 0, animations.data(), animationBufferSize);
+
+    // 面变换只在 GPU 上产生和消费, 放在显存里; 异步计算时由计算队列写、图形队列读
+    VkDeviceSize transformBufferSize = sizeof(glm::mat4) * MassScene::s_faceCount * massScene->instanceCount();
+    massTransformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    massTransformAllocations.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        createBuffer(transformBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            massTransformBuffers[i], massTransformAllocations[i], nullptr, 0, true);
+    }
+
+    if (massCulling) {
+        VkDeviceSize drawBufferSize = s_drawCommandOffset + sizeof(VkDrawIndexedIndirectCommand) * massScene->instanceCount();
+        massDrawBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        massDrawAllocations.resize(MAX_FRAMES_IN_FLIGHT);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            createBuffer(drawBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, massDrawBuffers[i], massDrawAllocations[i]);
+        }
+    }
+
+    spdlog::info("Mass scene: {} nets, {:.2f} MB of instance data, {:.2f} MB of face transforms per frame, folded on the {} queue",
+        massScene->instanceCount(), (instanceBufferSize + animationBufferSize) / (1024.0 * 1024.0), transformBufferSize / (1024.0 * 1024.0),
+        computeQueue != VK_NULL_HANDLE ? "async compute" : "graphics");
+}
+
+void VulkanCube::updateMassScene(uint32_t frameIndex)
+{
+    if (!massScene) return;
+
+    ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::SceneUpdate);
+    massSceneSeconds = std::chrono::duration<float>(animationNow() - massSceneStart).count();
+    // 没有专用计算队列时折叠在 recordCommandBuffer 中录制到图形命令缓冲区
+    if (computeCommandBuffers.empty()) return;
+
+    // 该帧的 fence 已经等待过, 上一次使用这个命令缓冲区的提交已经完成
+    VkCommandBuffer commandBuffer = computeCommandBuffers[frameIndex];
+    vkResetCommandBuffer(commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording compute command buffer!");
+    }
+    recordMassFold(commandBuffer, frameIndex);
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record compute command buffer!");
+    }
+
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<VkPipelineStageFlags> waitStages;
+    appendUploadWaits(s_computeUploadConsumer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, waitSemaphores, waitStages);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &foldFinishedSemaphores[frameIndex];
+    if (vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit fold compute command buffer!");
+    }
+}
+
+void VulkanCube::recordMassFold(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+    struct {
+        float seconds;
+        uint32_t instanceCount;
+    } constants{ massSceneSeconds, massScene->instanceCount() };
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, foldPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, foldPipelineLayout, 0, 1, &foldDescriptorSets[frameIndex], 0, nullptr);
+    vkCmdPushConstants(commandBuffer, foldPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(commandBuffer, (constants.instanceCount + 63) / 64, 1, 1);
+}
+
+void VulkanCube::recordMassCull(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+    // 有 count 版本时只需清零计数; 否则整个缓冲区清零, 未写入的命令 indexCount 为 0, 不产生任何绘制
+    VkBuffer drawBuffer = massDrawBuffers[frameIndex];
+    vkCmdFillBuffer(commandBuffer, drawBuffer, 0, cmdDrawIndexedIndirectCount ? s_drawCommandOffset : VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // 可见实例写入各自分区的区段, 每个分区由一个次级命令缓冲区绘制
+    struct {
+        glm::mat4 model;
+        uint32_t instanceCount;
+        uint32_t partitionSize;
+        float boundingRadius;
+        uint32_t indexCount;
+    } constants{ model, massScene->instanceCount(), massPartitionSize(), massBoundingRadius, massIndices.count };
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSets[frameIndex], 1, &frameUniformOffset);
+    vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(commandBuffer, (constants.instanceCount + 63) / 64, 1, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+uint32_t VulkanCube::massPartitionSize() const
+{
+    uint32_t partitionCount = commandRecorder->partitionCount();
+    return (massScene->instanceCount() + partitionCount - 1) / partitionCount;
+}
+
+void VulkanCube::recordMassPartition(VkCommandBuffer commandBuffer, uint32_t partition, uint32_t massScope)
+{
+    // 分区按实例号连续划分; 所有实例共享同一份网格, 面号存在顶点里, 颜色和变换按实例号从 SSBO 读取
+    uint32_t partitionSize = massPartitionSize();
+    uint32_t firstInstance = std::min(partition * partitionSize, massScene->instanceCount());
+    uint32_t instanceCount = std::min(partitionSize, massScene->instanceCount() - firstInstance);
+    bool lastPartition = partition + 1 == commandRecorder->partitionCount();
+
+    // 次级命令缓冲区按分区顺序执行, 第一个分区写开始时间戳, 最后一个分区写结束时间戳
+    if (partition == 0) {
+        gpuProfiler->writeScopeBegin(commandBuffer, massScope);
+    }
+    // 实例数少于分区数时末尾的分区为空, 不画但仍要在最后一个分区结束计时
+    if (instanceCount == 0) {
+        if (lastPartition) {
+            gpuProfiler->endScope(commandBuffer, massScope);
+        }
+        return;
+    }
 
-            vertex.color = { 1.0f, 1.0f, 1.0f };
+    // 动态状态不从主命令缓冲区继承
+    VkViewport viewport{};
+    viewport.width = (float)renderTargets.extent.width;
+    viewport.height = (float)renderTargets.extent.height;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-            if (uniqueVertices.count(vertex) == 0) {
-                uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                vertices.push_back(vertex);
-            }
+    VkRect2D scissor{};
+    scissor.extent = renderTargets.extent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-            indices.push_back(uniqueVertices[vertex]);
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &massVertexBuffer, &offset);
+    vkCmdBindIndexBuffer(commandBuffer, massIndexBuffer, 0, massIndices.type);
+    std::array<VkDescriptorSet, 2> frameDescriptorSets = { massDescriptorSets[currentFrame], materialDescriptorSets[currentFrame] };
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, massPipelineLayout, 0, static_cast<uint32_t>(frameDescriptorSets.size()), frameDescriptorSets.data(),
+        1, &frameUniformOffset);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderTargets.massPipeline);
+    // 大场景不画描边和标记
+    DrawConstants drawConstants{};
+    drawConstants.model = model;
+    drawConstants.positionScale = massPositions.scale;
+    drawConstants.positionOffset = massPositions.offset;
+    vkCmdPushConstants(commandBuffer, massPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(drawConstants), &drawConstants);
+    if (!massCulling) {
+        vkCmdDrawIndexed(commandBuffer, massIndices.count, instanceCount, 0, 0, firstInstance);
+    }
+    else {
+        // 每个可见实例一条命令, firstInstance 是实例号, 顶点着色器不需要区分是否剔除过
+        VkDeviceSize commandOffset = s_drawCommandOffset + sizeof(VkDrawIndexedIndirectCommand) * firstInstance;
+        if (cmdDrawIndexedIndirectCount) {
+            cmdDrawIndexedIndirectCount(commandBuffer, massDrawBuffers[currentFrame], commandOffset, massDrawBuffers[currentFrame], sizeof(uint32_t) * partition,
+                instanceCount, sizeof(VkDrawIndexedIndirectCommand));
         }
+        else {
+            vkCmdDrawIndexedIndirect(commandBuffer, massDrawBuffers[currentFrame], commandOffset, instanceCount, sizeof(VkDrawIndexedIndirectCommand));
+        }
+    }
+
+    if (lastPartition) {
+        gpuProfiler->endScope(commandBuffer, massScope);
     }
 }
-*/
 
-void VulkanCube::createVertexBuffer()
+void VulkanCube::createCaptureResources()
 {
-    vertices = {
-        glm::vec3(-4.f, -1.f, 0.f), // 0
-        glm::vec3(-2.f, -1.f, 0.f), // 1
-        glm::vec3(-2.f,  1.f, 0.f), // 2
-        glm::vec3(-4.f,  1.f, 0.f), // 3
-        glm::vec3(-2.f, -3.f, 0.f), // 4
-        glm::vec3( 0.f, -3.f, 0.f), // 5
-        glm::vec3( 0.f, -1.f, 0.f), // 6
-        glm::vec3(-2.f, -1.f, 0.f), // 7
-        glm::vec3(-2.f, -1.f, 0.f), // 8
-        glm::vec3( 0.f, -1.f, 0.f), // 9
-        glm::vec3( 0.f,  1.f, 0.f), // 10
-        glm::vec3(-2.f,  1.f, 0.f), // 11
-        glm::vec3( 0.f, -1.f, 0.f), // 12
-        glm::vec3( 2.f, -1.f, 0.f), // 13
-        glm::vec3( 2.f,  1.f, 0.f), // 14
-        glm::vec3( 0.f,  1.f, 0.f), // 15
-        glm::vec3( 0.f,  1.f, 0.f), // 16
-        glm::vec3( 2.f,  1.f, 0.f), // 17
-        glm::vec3( 2.f,  3.f, 0.f), // 18
-        glm::vec3( 0.f,  3.f, 0.f), // 19
-        glm::vec3( 2.f, -1.f, 0.f), // 20
-        glm::vec3( 4.f, -1.f, 0.f), // 21
-        glm::vec3( 4.f,  1.f, 0.f), // 22
-        glm::vec3( 2.f,  1.f, 0.f), // 23
-    };
+    TRACE_FUNCTION("vulkan");
+    if (config.captureDirectory.empty()) return;
 
-    VkDeviceSize vertexBufferSize = sizeof(vertices[0]) * vertices.size();
-    createBuffer(vertexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vertexBuffer, vertexBufferMemory);
+    if (!isCaptureFormatSupported(swapChainImageFormat)) {
+        spdlog::error("Frame capture needs an 8-bit RGBA or BGRA swapchain, but the surface uses format {}", static_cast<int>(swapChainImageFormat));
+        throw std::runtime_error("failed to start frame capture: unsupported swapchain format!");
+    }
 
-    vkMapMemory(device, vertexBufferMemory, 0, vertexBufferSize, 0, &vertexBufferMappedPtr);
-    memcpy(vertexBufferMappedPtr, vertices.data(), (size_t)vertexBufferSize);
+    // 暂存缓冲区在首次使用时按当前分辨率分配, 窗口变大时由 recordCapture 重新分配空闲槽位
+    captureWriter = std::make_unique<ImageSequenceWriter>(config.captureDirectory, ImageSequenceWriter::parseFormat(config.captureFormat));
+    spdlog::info("Capturing frames to {} as {}", config.captureDirectory, config.captureFormat);
+}
 
-    color = {
-        glm::vec3(0.8f, 0.8f, 0.0f), // f
-        glm::vec3(0.0f, 0.8f, 0.8f), // f
-        glm::vec3(0.8f, 0.0f, 0.8f), // f
-        glm::vec3(0.8f, 0.3f, 0.0f), // f
-        glm::vec3(0.0f, 0.8f, 0.0f), // f
-        glm::vec3(0.0f, 0.0f, 0.8f), // f
-        glm::vec3(0.8f, 0.8f, 0.8f), // s
-        glm::vec3(0.8f, 0.0f, 0.0f), // i
-    };
+void VulkanCube::recordCapture(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    if (!captureWriter) return;
+    // 重建后的交换链可能换了格式, 不支持的格式不回读, 按丢弃计数
+    if (!isCaptureFormatSupported(swapChainImageFormat)) {
+        ++droppedCaptures;
+        return;
+    }
+
+    CaptureSlot& slot = captureSlots[nextCaptureSlot];
+    if (slot.state.load(std::memory_order_acquire) != CaptureState::Free) {
+        // 写盘跟不上时丢弃这一帧, 绝不阻塞渲染
+        ++droppedCaptures;
+        return;
+    }
+    nextCaptureSlot = (nextCaptureSlot + 1) % s_captureRingSize;
+
+    VkDeviceSize size = static_cast<VkDeviceSize>(swapChainExtent.width) * swapChainExtent.height * 4;
+    if (slot.capacity < size) {
+        if (slot.buffer != VK_NULL_HANDLE) {
+            vmaDestroyBuffer(allocator, slot.buffer, slot.allocation);
+        }
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, slot.buffer, slot.allocation,
+            &slot.mapped, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+        slot.capacity = size;
+    }
 
-    VkDeviceSize colorBufferSize = sizeof(color[0]) * color.size();
-    createBuffer(colorBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, colorBuffer, colorBufferMemory);
+    VkImageLayout finalLayout = config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
-    void* data;
-    vkMapMemory(device, colorBufferMemory, 0, colorBufferSize, 0, &data);
-    memcpy(data, color.data(), (size_t)colorBufferSize);
-    vkUnmapMemory(device, colorBufferMemory);
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = finalLayout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = swapChainImages[imageIndex];
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    // 交换链图像可能由渲染通道 resolve 写入, 也可能由放大拷贝写入
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { swapChainExtent.width, swapChainExtent.height, 1 };
+    vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+    VkBufferMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = slot.buffer;
+    hostBarrier.size = size;
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = finalLayout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        0, nullptr, 1, &hostBarrier, 1, &barrier);
+
+    slot.frameIndex = currentFrame;
+    slot.frameNumber = frameNumber;
+    slot.extent = swapChainExtent;
+    slot.bgra = swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB || swapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM;
+    slot.state.store(CaptureState::Pending, std::memory_order_release);
 }
 
-void VulkanCube::createIndexBuffer()
+void VulkanCube::collectCompletedCaptures(bool all)
 {
-    indices = {
-         0,  1,  2,  0,  2,  3,
-         4,  5,  6,  4,  6,  7,
-         8,  9, 10,  8, 10, 11,
-        12, 13, 14, 12, 14, 15,
-        16, 17, 18, 16, 18, 19,
-        20, 21, 22, 20, 22, 23,
-         0,  2
-    };
-    std::vector<uint16_t> uploadIndices;
-    uploadIndices.resize(indexMaxCount, 0);
-    for (size_t i = 0; i < indices.size(); ++i) {
-        uploadIndices[i] = indices[i];
+    if (!captureWriter) return;
+
+    // 调用方已经等待过 currentFrame 的 fence, 属于该帧的拷贝一定已经完成
+    for (auto& slot : captureSlots) {
+        if (slot.state.load(std::memory_order_acquire) != CaptureState::Pending) continue;
+        if (!all && slot.frameIndex != currentFrame) continue;
+
+        VkDeviceSize size = static_cast<VkDeviceSize>(slot.extent.width) * slot.extent.height * 4;
+        vmaInvalidateAllocation(allocator, slot.allocation, 0, size);
+        slot.state.store(CaptureState::Writing, std::memory_order_release);
+        CaptureSlot* slotPtr = &slot;
+        captureWriter->submit(slot.frameNumber, slot.extent.width, slot.extent.height, slot.bgra, static_cast<const uint8_t*>(slot.mapped),
+            [slotPtr]() { slotPtr->state.store(CaptureState::Free, std::memory_order_release); });
     }
-    VkDeviceSize bufferSize = sizeof(uploadIndices[0]) * indexMaxCount;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indexBuffer, indexBufferMemory);
-
-    vkMapMemory(device, indexBufferMemory, 0, bufferSize, 0, &indexBufferMapperPtr);
-    memcpy(indexBufferMapperPtr, uploadIndices.data(), (size_t)bufferSize);
 }
 
-void VulkanCube::createUniformBuffers()
+void VulkanCube::finishCapture()
 {
-    VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-    uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+    if (!captureWriter) return;
 
-        vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
-    }
+    vkDeviceWaitIdle(device);
+    collectCompletedCaptures(true);
+    captureWriter->finish();
+    spdlog::info("Captured {} frames to {}, dropped {}", captureWriter->writtenCount(), config.captureDirectory, droppedCaptures);
+    captureWriter.reset();
 }
 
 void VulkanCube::createDescriptorPool()
 {
+    TRACE_FUNCTION("vulkan");
+    // 交互场景的帧常量集合只有一个; 大场景模式每个飞行帧多三个描述符集: 绘制用的帧常量加两个 SSBO, 折叠计算用的两个 SSBO,
+    // 剔除用的帧常量加两个 SSBO. 帧常量都是动态偏移的 UBO
+    uint32_t framedSets = massScene ? 3 : 0;
     std::array<VkDescriptorPoolSize, 2> poolSizes{};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = 1 + static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * 2;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * 6;
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolInfo.maxSets = 1 + static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * framedSets;
 
     if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
         throw std::runtime_error("failed to create descriptor pool!");
     }
+
+    // 无绑定的材质集合的布局要求从带 UPDATE_AFTER_BIND 的池中分配, 单独一个池
+    std::array<VkDescriptorPoolSize, 2> materialPoolSizes{};
+    materialPoolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    materialPoolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    materialPoolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    materialPoolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * materialTextureCapacity;
+
+    poolInfo.flags = bindlessMaterials ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT : 0;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(materialPoolSizes.size());
+    poolInfo.pPoolSizes = materialPoolSizes.data();
+    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &materialDescriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create material descriptor pool!");
+    }
 }
 
 void VulkanCube::createDescriptorSets()
 {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
+    TRACE_FUNCTION("vulkan");
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
+    if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate descriptor sets!");
+    }
+
+    // 帧常量在 FrameAllocator 的缓冲区里, 绑定时用动态偏移选中本帧的那一份
+    VkDescriptorBufferInfo frameBufferInfo{};
+    frameBufferInfo.buffer = frameAllocator->buffer();
+    frameBufferInfo.offset = 0;
+    frameBufferInfo.range = sizeof(UniformBufferObject);
+    VkWriteDescriptorSet frameDescriptorWrite{};
+    frameDescriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    frameDescriptorWrite.dstSet = descriptorSet;
+    frameDescriptorWrite.dstBinding = 0;
+    frameDescriptorWrite.dstArrayElement = 0;
+    frameDescriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    frameDescriptorWrite.descriptorCount = 1;
+    frameDescriptorWrite.pBufferInfo = &frameBufferInfo;
+    vkUpdateDescriptorSets(device, 1u, &frameDescriptorWrite, 0, nullptr);
+
     allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    allocInfo.pSetLayouts = layouts.data();
 
-    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-    if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate descriptor sets!");
+    // 材质集合的纹理数组按最大长度分配, 纹理在录制前按需写入当前的视图
+    std::vector<VkDescriptorSetLayout> materialLayouts(MAX_FRAMES_IN_FLIGHT, materialDescriptorSetLayout);
+    std::vector<uint32_t> textureCounts(MAX_FRAMES_IN_FLIGHT, materialTextureCapacity);
+    VkDescriptorSetVariableDescriptorCountAllocateInfoEXT variableCountInfo{};
+    variableCountInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+    variableCountInfo.descriptorSetCount = static_cast<uint32_t>(textureCounts.size());
+    variableCountInfo.pDescriptorCounts = textureCounts.data();
+    VkDescriptorSetAllocateInfo materialAllocInfo = allocInfo;
+    materialAllocInfo.pNext = bindlessMaterials ? &variableCountInfo : nullptr;
+    materialAllocInfo.descriptorPool = materialDescriptorPool;
+    materialAllocInfo.pSetLayouts = materialLayouts.data();
+    materialDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    if (vkAllocateDescriptorSets(device, &materialAllocInfo, materialDescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate material descriptor sets!");
     }
+    materialDescriptorGenerations.assign(MAX_FRAMES_IN_FLIGHT, std::vector<uint64_t>(materialTextures.size(), 0));
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = uniformBuffers[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
-        /*
-        VkDescriptorImageInfo imageInfo{};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = textureImageView;
-        imageInfo.sampler = textureSampler;
+        bufferInfo.buffer = materialBuffer;
+        bufferInfo.range = VK_WHOLE_SIZE;
 
-        std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = descriptorSets[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = descriptorSets[i];
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = 1;
-        descriptorWrites[1].pImageInfo = &imageInfo;
-        */
         VkWriteDescriptorSet descriptorWrite{};
-
         descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = descriptorSets[i];
+        descriptorWrite.dstSet = materialDescriptorSets[i];
         descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
-        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         descriptorWrite.descriptorCount = 1;
         descriptorWrite.pBufferInfo = &bufferInfo;
         vkUpdateDescriptorSets(device, 1u, &descriptorWrite, 0, nullptr);
-        //vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    if (!massScene) return;
+
+    std::vector<VkDescriptorSetLayout> massLayouts(MAX_FRAMES_IN_FLIGHT, massDescriptorSetLayout);
+    allocInfo.pSetLayouts = massLayouts.data();
+    massDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    if (vkAllocateDescriptorSets(device, &allocInfo, massDescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate mass scene descriptor sets!");
+    }
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        std::array<VkDescriptorBufferInfo, 3> bufferInfos{};
+        bufferInfos[0].buffer = frameAllocator->buffer();
+        bufferInfos[0].range = sizeof(UniformBufferObject);
+        bufferInfos[1].buffer = massInstanceBuffer;
+        bufferInfos[1].range = VK_WHOLE_SIZE;
+        bufferInfos[2].buffer = massTransformBuffers[i];
+        bufferInfos[2].range = VK_WHOLE_SIZE;
+
+        std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+        for (uint32_t binding = 0; binding < descriptorWrites.size(); ++binding) {
+            descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[binding].dstSet = massDescriptorSets[i];
+            descriptorWrites[binding].dstBinding = binding;
+            descriptorWrites[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[binding].descriptorCount = 1;
+            descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    std::vector<VkDescriptorSetLayout> foldLayouts(MAX_FRAMES_IN_FLIGHT, foldDescriptorSetLayout);
+    allocInfo.pSetLayouts = foldLayouts.data();
+    foldDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    if (vkAllocateDescriptorSets(device, &allocInfo, foldDescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate fold descriptor sets!");
+    }
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        std::array<VkDescriptorBufferInfo, 2> bufferInfos{};
+        bufferInfos[0].buffer = massAnimationBuffer;
+        bufferInfos[0].range = VK_WHOLE_SIZE;
+        bufferInfos[1].buffer = massTransformBuffers[i];
+        bufferInfos[1].range = VK_WHOLE_SIZE;
+
+        std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+        for (uint32_t binding = 0; binding < descriptorWrites.size(); ++binding) {
+            descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[binding].dstSet = foldDescriptorSets[i];
+            descriptorWrites[binding].dstBinding = binding;
+            descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[binding].descriptorCount = 1;
+            descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    if (!massCulling) return;
+
+    std::vector<VkDescriptorSetLayout> cullLayouts(MAX_FRAMES_IN_FLIGHT, cullDescriptorSetLayout);
+    allocInfo.pSetLayouts = cullLayouts.data();
+    cullDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    if (vkAllocateDescriptorSets(device, &allocInfo, cullDescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate cull descriptor sets!");
+    }
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        std::array<VkDescriptorBufferInfo, 3> bufferInfos{};
+        bufferInfos[0].buffer = frameAllocator->buffer();
+        bufferInfos[0].range = sizeof(UniformBufferObject);
+        bufferInfos[1].buffer = massInstanceBuffer;
+        bufferInfos[1].range = VK_WHOLE_SIZE;
+        bufferInfos[2].buffer = massDrawBuffers[i];
+        bufferInfos[2].range = VK_WHOLE_SIZE;
+
+        std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+        for (uint32_t binding = 0; binding < descriptorWrites.size(); ++binding) {
+            descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[binding].dstSet = cullDescriptorSets[i];
+            descriptorWrites[binding].dstBinding = binding;
+            descriptorWrites[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[binding].descriptorCount = 1;
+            descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
     }
 }
 
-void VulkanCube::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+void VulkanCube::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VmaAllocation& allocation,
+    void** mappedPtr, VkMemoryPropertyFlags preferredProperties, bool shared)
 {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // 被多个队列族访问的缓冲区用 CONCURRENT 模式, 省去队列族所有权转移
+    if (shared && sharedQueueFamilies.size() > 1) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharedQueueFamilies.size());
+        bufferInfo.pQueueFamilyIndices = sharedQueueFamilies.data();
+    }
+
+    // 缓冲区从 VMA 的内存块中子分配, 不再为每个资源单独调用 vkAllocateMemory
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_UNKNOWN;
+    allocCreateInfo.requiredFlags = properties;
+    allocCreateInfo.preferredFlags = preferredProperties;
+    if (mappedPtr != nullptr) {
+        allocCreateInfo.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    }
 
-    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+    VmaAllocationInfo allocInfo{};
+    if (vmaCreateBuffer(allocator, &bufferInfo, &allocCreateInfo, &buffer, &allocation, &allocInfo) != VK_SUCCESS) {
         throw std::runtime_error("failed to create buffer!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+    if (mappedPtr != nullptr) {
+        *mappedPtr = allocInfo.pMappedData;
+    }
+}
+
+void VulkanCube::createDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VmaAllocation& allocation, void** mappedPtr, bool shared)
+{
+    if (directDeviceWrites) {
+        // 显存对 CPU 可见, 直接持久映射; 非 coherent 的内存在 writeBuffer 中显式 flush
+        createBuffer(size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, buffer, allocation,
+            mappedPtr, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, shared);
+    }
+    else {
+        // 初始数据由传输队列写入, 与使用它的队列共享
+        createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, allocation, nullptr, 0, true);
+        *mappedPtr = nullptr;
+    }
+}
+
+void VulkanCube::writeBuffer(VkBuffer buffer, VmaAllocation allocation, void* mappedPtr, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+    if (mappedPtr != nullptr) {
+        memcpy(static_cast<uint8_t*>(mappedPtr) + offset, data, static_cast<size_t>(size));
+        vmaFlushAllocation(allocator, allocation, offset, size);
+        return;
+    }
+
+    // 同一区域的旧数据还没上传时直接覆盖, 避免每帧堆积重复的拷贝
+    for (auto& upload : pendingUploads) {
+        if (upload.dstBuffer == buffer && upload.dstOffset == offset && upload.data.size() == size) {
+            memcpy(upload.data.data(), data, static_cast<size_t>(size));
+            return;
+        }
+    }
+    PendingUpload upload;
+    upload.dstBuffer = buffer;
+    upload.dstOffset = offset;
+    upload.data.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+    pendingUploads.push_back(std::move(upload));
+}
+
+void VulkanCube::submitPendingUploads()
+{
+    TRACE_FUNCTION("vulkan");
+    if (pendingUploads.empty()) return;
+
+    // 所有初始化数据合并成一批交给传输队列, 不等待完成; 第一帧的提交在读取前等待该批次的信号量
+    for (const auto& upload : pendingUploads) {
+        transferQueue->enqueue(upload.dstBuffer, upload.dstOffset, upload.data.data(), upload.data.size());
+    }
+    VkDeviceSize size = transferQueue->flush();
+    spdlog::info("Submitted {} initial uploads ({:.2f} MB) in one transfer batch", pendingUploads.size(), size / (1024.0 * 1024.0));
+    pendingUploads.clear();
+}
+
+void VulkanCube::appendUploadWaits(uint32_t consumer, VkPipelineStageFlags stages, std::vector<VkSemaphore>& waitSemaphores, std::vector<VkPipelineStageFlags>& waitStages)
+{
+    for (auto semaphore : transferQueue->takeWaitSemaphores(consumer)) {
+        waitSemaphores.push_back(semaphore);
+        waitStages.push_back(stages);
+        uploadWaitSemaphores.push_back(semaphore);
+    }
+}
+
+void VulkanCube::recycleUploadWaits()
+{
+    // 调用时本帧的图形提交已经计入 submitSerial; 计算提交在它之前并被它等待, 一起在该帧完成后归还
+    if (uploadWaitSemaphores.empty()) return;
+    deferDestroy([this, semaphores = std::move(uploadWaitSemaphores)]() {
+        transferQueue->recycleSemaphores(semaphores);
+    });
+    uploadWaitSemaphores.clear();
+}
+
+void VulkanCube::retireOverflowStaging()
+{
+    // 调用时本帧的图形提交已经计入 submitSerial
+    if (overflowStagingBuffer == VK_NULL_HANDLE) return;
+    deferDestroy([this, buffer = overflowStagingBuffer, allocation = overflowStagingAllocation]() {
+        vmaDestroyBuffer(allocator, buffer, allocation);
+    });
+    overflowStagingBuffer = VK_NULL_HANDLE;
+    overflowStagingAllocation = VK_NULL_HANDLE;
+}
+
+void VulkanCube::recordPendingUploads(VkCommandBuffer commandBuffer)
+{
+    if (pendingUploads.empty()) return;
+
+    VkDeviceSize totalSize = 0;
+    for (const auto& upload : pendingUploads) {
+        totalSize += upload.data.size();
+    }
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    // 暂存数据从帧分配器中取, 随本帧的提交完成一起释放; 写入量超过帧分配器的空闲空间时临时创建一个暂存缓冲区,
+    // 由 retireOverflowStaging 在本帧提交后延迟销毁
+    VkBuffer stagingBuffer = frameAllocator->buffer();
+    FrameAllocator::Allocation staging;
+    if (!frameAllocator->tryAllocate(totalSize, staging)) {
+        createBuffer(totalSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, overflowStagingBuffer, overflowStagingAllocation, &staging.data);
+        stagingBuffer = overflowStagingBuffer;
+        spdlog::debug("Pending uploads ({} bytes) exceed the frame allocator, using a temporary staging buffer", totalSize);
+    }
 
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate buffer memory!");
+    // 上一帧可能仍在读取顶点和索引, 拷贝前后都需要屏障
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    VkDeviceSize srcOffset = 0;
+    for (const auto& upload : pendingUploads) {
+        memcpy(static_cast<uint8_t*>(staging.data) + srcOffset, upload.data.data(), upload.data.size());
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = staging.offset + srcOffset;
+        copyRegion.dstOffset = upload.dstOffset;
+        copyRegion.size = upload.data.size();
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer, upload.dstBuffer, 1, &copyRegion);
+        srcOffset += upload.data.size();
     }
+    if (stagingBuffer == overflowStagingBuffer) {
+        vmaFlushAllocation(allocator, overflowStagingAllocation, 0, totalSize);
+    }
+    else {
+        frameAllocator->flush(staging, totalSize);
+    }
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-    vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    pendingUploads.clear();
 }
 
 VkCommandBuffer VulkanCube::beginSingleTimeCommands()
@@ -2060,22 +4142,9 @@ void VulkanCube::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize
     endSingleTimeCommands(commandBuffer);
 }
 
-uint32_t VulkanCube::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
-{
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
-    }
-
-    throw std::runtime_error("failed to find suitable memory type!");
-}
-
 void VulkanCube::createCommandBuffers()
 {
+    TRACE_FUNCTION("vulkan");
     commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
     VkCommandBufferAllocateInfo allocInfo{};
@@ -2087,6 +4156,14 @@ void VulkanCube::createCommandBuffers()
     if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
         throw std::runtime_error("failed to allocate command buffers!");
     }
+
+    if (massScene && computeCommandPool != VK_NULL_HANDLE) {
+        computeCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        allocInfo.commandPool = computeCommandPool;
+        if (vkAllocateCommandBuffers(device, &allocInfo, computeCommandBuffers.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate compute command buffers!");
+        }
+    }
 }
 
 void VulkanCube::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
@@ -2098,99 +4175,126 @@ void VulkanCube::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t ima
         throw std::runtime_error("failed to begin recording command buffer!");
     }
 
-    VkRenderPassBeginInfo renderPassInfo{};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = renderPass;
-    renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
-    renderPassInfo.renderArea.offset = { 0, 0 };
-    renderPassInfo.renderArea.extent = swapChainExtent;
-
-    std::array<VkClearValue, 2> clearValues{};
-    clearValues[0].color = { {0.0f, 0.0f, 0.0f, 1.0f} };
-    clearValues[1].depthStencil = { 1.0f, 0 };
-
-    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-    renderPassInfo.pClearValues = clearValues.data();
-
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)swapChainExtent.width;
-    viewport.height = (float)swapChainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-
-    VkRect2D scissor{};
-    scissor.offset = { 0, 0 };
-    scissor.extent = swapChainExtent;
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-
-    std::vector<VkBuffer> vertexBuffers = { vertexBuffer, colorBuffer };
-    std::vector<VkDeviceSize> offsets = { 0, 0 };
-    vkCmdBindVertexBuffers(commandBuffer, 0, static_cast<uint32_t>(vertexBuffers.size()), vertexBuffers.data(), offsets.data());
+    gpuProfiler->beginFrame(commandBuffer, currentFrame);
 
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+    uint32_t uploadScope = gpuProfiler->beginScope(commandBuffer, "uploads");
+    recordPendingUploads(commandBuffer);
+    gpuProfiler->endScope(commandBuffer, uploadScope);
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipeline);
+    if (massScene && computeCommandBuffers.empty()) {
+        uint32_t foldScope = gpuProfiler->beginScope(commandBuffer, "fold");
+        recordMassFold(commandBuffer, currentFrame);
+        gpuProfiler->endScope(commandBuffer, foldScope);
 
-    for (uint32_t i = 0; i < 6; ++i) {
-        vkCmdDrawIndexed(commandBuffer, 6, 1, 6 * i, 0, i);
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
     }
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, linePipeline);
-    vkCmdDrawIndexed(commandBuffer, 2, 1, 36, 0, 6);
+    if (massScene && massCulling) {
+        uint32_t cullScope = gpuProfiler->beginScope(commandBuffer, "cull");
+        recordMassCull(commandBuffer, currentFrame);
+        gpuProfiler->endScope(commandBuffer, cullScope);
+    }
 
-    if (clickTime == 1) {
-        std::array<uint16_t, 8> appendIds{};
-        uint16_t offset = selectedFace[0] * 4;
-        for (uint16_t i = 0; i < 4; ++i) {
-            if (i != 3) {
-                appendIds[i * 2] = offset + i;
-                appendIds[i * 2 + 1] = offset + i + 1;
-            }
-            else {
-                appendIds[i * 2] = offset + i;
-                appendIds[i * 2 + 1] = offset;
-            }
+    uint32_t renderPassScope = gpuProfiler->beginScope(commandBuffer, "render pass");
+    if (massScene) {
+        // 大场景的渲染通道内容全部来自按实例分区并行录制的次级命令缓冲区
+        beginSceneRendering(commandBuffer, imageIndex, true);
+
+        // 动态渲染时次级命令缓冲区继承附件格式和采样数, 否则继承渲染通道和帧缓冲
+        VkCommandBufferInheritanceRenderingInfoKHR inheritanceRendering{};
+        inheritanceRendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+        inheritanceRendering.colorAttachmentCount = 1;
+        inheritanceRendering.pColorAttachmentFormats = &renderTargets.format;
+        inheritanceRendering.depthAttachmentFormat = depthFormat;
+        inheritanceRendering.rasterizationSamples = renderTargets.samples;
+
+        VkCommandBufferInheritanceInfo inheritance{};
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        if (dynamicRendering) {
+            inheritance.pNext = &inheritanceRendering;
+        }
+        else {
+            inheritance.renderPass = renderTargets.renderPass;
+            inheritance.subpass = 0;
+            inheritance.framebuffer = renderTargets.framebuffers[imageIndex];
         }
-        memcpy(reinterpret_cast<uint16_t*>(indexBufferMapperPtr) + 38, appendIds.data(), sizeof(uint16_t) * appendIds.size());
 
-        vkCmdDrawIndexed(commandBuffer, 8, 1, 38, 0, 7);
+        uint32_t massScope = gpuProfiler->reserveScope("mass scene");
+        const auto& secondaries = commandRecorder->record(currentFrame, inheritance, [this, massScope](uint32_t partition, VkCommandBuffer secondary) {
+            recordMassPartition(secondary, partition, massScope);
+        });
+        vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
     }
-    if (interactive) {
-        std::array<uint16_t, 16> appendIds{};
-        uint16_t offset = selectedFace[0] * 4;
-        for (uint16_t i = 0; i < 4; ++i) {
-            if (i != 3) {
-                appendIds[i * 2] = offset + i;
-                appendIds[i * 2 + 1] = offset + i + 1;
-            }
-            else {
-                appendIds[i * 2] = offset + i;
-                appendIds[i * 2 + 1] = offset;
+    else {
+        beginSceneRendering(commandBuffer, imageIndex, false);
+
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float)renderTargets.extent.width;
+        viewport.height = (float)renderTargets.extent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D scissor{};
+        scissor.offset = { 0, 0 };
+        scissor.extent = renderTargets.extent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        std::vector<VkBuffer> vertexBuffers = { vertexBuffer, colorBuffer };
+        std::vector<VkDeviceSize> offsets = { 0, 0 };
+        vkCmdBindVertexBuffers(commandBuffer, 0, static_cast<uint32_t>(vertexBuffers.size()), vertexBuffers.data(), offsets.data());
+
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+        std::array<VkDescriptorSet, 2> frameDescriptorSets = { descriptorSet, materialDescriptorSets[currentFrame] };
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(frameDescriptorSets.size()), frameDescriptorSets.data(),
+            1, &frameUniformOffset);
+        uint32_t triangleScope = gpuProfiler->beginScope(commandBuffer, "triangles");
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderTargets.trianglePipeline);
+
+        // 第 0 个面画对角线标记, 选中的面描边; 折叠时选中两个面, 第一次点击后选中一个面
+        DrawConstants drawConstants{};
+        drawConstants.model = model;
+        drawConstants.diagonalMask = 1u << 0;
+        if (clickTime == 1 || interactive) {
+            size_t faceCount = interactive ? 2 : 1;
+            for (size_t face = 0; face < faceCount; ++face) {
+                drawConstants.outlineMask |= 1u << selectedFace[face];
             }
         }
-        offset = selectedFace[1] * 4;
-        for (uint16_t i = 0; i < 4; ++i) {
-            if (i != 3) {
-                appendIds[i * 2 + 8] = offset + i;
-                appendIds[i * 2 + 1 + 8] = offset + i + 1;
-            }
-            else {
-                appendIds[i * 2 + 8] = offset + i;
-                appendIds[i * 2 + 1 + 8] = offset;
-            }
+        // 面按顺序轮流取用材质
+        std::array<uint32_t, MassScene::s_faceCount> faceMaterials{};
+        for (uint32_t face = 0; face < MassScene::s_faceCount; ++face) {
+            faceMaterials[face] = face % static_cast<uint32_t>(materials.size());
         }
-        memcpy(reinterpret_cast<uint16_t*>(indexBufferMapperPtr) + 38, appendIds.data(), sizeof(uint16_t) * appendIds.size());
+        drawConstants.faceMaterials = MassScene::packFaceMaterials(faceMaterials);
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(drawConstants), &drawConstants);
+
+        // 面号由顶点号推出, 材质在着色器里按面号选择, 6 个面一次画完
+        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+        gpuProfiler->endScope(commandBuffer, triangleScope);
+    }
+
+    endSceneRendering(commandBuffer, imageIndex);
+    gpuProfiler->endScope(commandBuffer, renderPassScope);
 
-        vkCmdDrawIndexed(commandBuffer, 16, 1, 38, 0, 7);
+    if (renderTargets.sceneImage != VK_NULL_HANDLE) {
+        uint32_t upscaleScope = gpuProfiler->beginScope(commandBuffer, "upscale");
+        recordUpscale(commandBuffer, imageIndex);
+        gpuProfiler->endScope(commandBuffer, upscaleScope);
     }
 
-    vkCmdEndRenderPass(commandBuffer);
+    uint32_t captureScope = gpuProfiler->beginScope(commandBuffer, "capture");
+    recordCapture(commandBuffer, imageIndex);
+    gpuProfiler->endScope(commandBuffer, captureScope);
+
+    gpuProfiler->endFrame(commandBuffer);
 
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to record command buffer!");
@@ -2199,9 +4303,11 @@ void VulkanCube::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t ima
 
 void VulkanCube::createSyncObjects()
 {
+    TRACE_FUNCTION("vulkan");
     imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    inFlightSubmitSerials.assign(MAX_FRAMES_IN_FLIGHT, 0);
 
     VkSemaphoreCreateInfo semaphoreInfo{};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -2217,26 +4323,96 @@ void VulkanCube::createSyncObjects()
             throw std::runtime_error("failed to create synchronization objects for a frame!");
         }
     }
+
+    if (!computeCommandBuffers.empty()) {
+        foldFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &foldFinishedSemaphores[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create synchronization objects for a frame!");
+            }
+        }
+    }
 }
 
-void VulkanCube::updateUniformBuffer(uint32_t currentImage)
+void VulkanCube::updateUniformBuffer()
 {
     if (rotating)
     {
         currentTime = std::chrono::high_resolution_clock::now();
         //float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - rotateStartTime).count();
         float time = -4.5f;
-        ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(10.0f), glm::vec3(-1.0f, 1.0f, 0.0f));
-        memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+        model = glm::rotate(glm::mat4(1.0f), time * glm::radians(10.0f), glm::vec3(-1.0f, 1.0f, 0.0f));
     }
+    // 每帧写入新分配的一份, 在飞行的帧读取的旧数据不受影响; 模型矩阵在录制时作为推送常量传入
+    frameUniformOffset = frameAllocator->push(ubo);
 }
 
 void VulkanCube::drawFrame()
 {
-    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    TRACE_FUNCTION("frame");
+    waitForFrameSlot();
+    pollPipelines(false);
+    pollRenderTargets();
+    streamTextures();
+    updateMaterialDescriptorSet(currentFrame);
+
+    if (config.headless) {
+        // 离屏图像与飞行帧一一对应, 不需要获取图像和呈现
+        {
+            ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::UpdateUniforms);
+            updateUniformBuffer();
+        }
+        updateMassScene(currentFrame);
+        vkResetFences(device, 1, &inFlightFences[currentFrame]);
+        {
+            ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::Record);
+            vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+            recordCommandBuffer(commandBuffers[currentFrame], currentFrame);
+        }
+
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<VkPipelineStageFlags> waitStages;
+        if (!foldFinishedSemaphores.empty()) {
+            waitSemaphores.push_back(foldFinishedSemaphores[currentFrame]);
+            waitStages.push_back(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+        }
+        transferQueue->flush();
+        appendUploadWaits(s_graphicsUploadConsumer, s_uploadWaitStages, waitSemaphores, waitStages);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+        {
+            ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::Submit);
+            if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit draw command buffer!");
+            }
+        }
+        inFlightSubmitSerials[currentFrame] = ++submitSerial;
+        frameAllocator->endFrame(submitSerial);
+        recycleUploadWaits();
+        retireOverflowStaging();
+        framePacer.onSubmit(currentFrame);
+        frameProfiler.onFrameEnd();
+
+        currentFrame = (currentFrame + 1) % framesInFlight;
+        ++frameNumber;
+        if (framePacer.consumeSettingsChanged()) {
+            applyFramePacing();
+        }
+        return;
+    }
 
     uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+    VkResult result;
+    {
+        ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::Acquire);
+        result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+    }
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
         recreateSwapChain();
@@ -2246,21 +4422,35 @@ void VulkanCube::drawFrame()
         throw std::runtime_error("failed to acquire swap chain image!");
     }
 
-    updateUniformBuffer(currentFrame);
+    {
+        ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::UpdateUniforms);
+        updateUniformBuffer();
+    }
+    updateMassScene(currentFrame);
 
     vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-    vkResetCommandBuffer(commandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
-    recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+    {
+        ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::Record);
+        vkResetCommandBuffer(commandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
+        recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+    }
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
+    std::vector<VkSemaphore> waitSemaphores = { imageAvailableSemaphores[currentFrame] };
+    // 缩放渲染时交换链图像的第一次写入是传输阶段的放大拷贝
+    std::vector<VkPipelineStageFlags> waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT };
+    if (!foldFinishedSemaphores.empty()) {
+        waitSemaphores.push_back(foldFinishedSemaphores[currentFrame]);
+        waitStages.push_back(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+    }
+    transferQueue->flush();
+    appendUploadWaits(s_graphicsUploadConsumer, s_uploadWaitStages, waitSemaphores, waitStages);
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
 
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
@@ -2269,9 +4459,17 @@ void VulkanCube::drawFrame()
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
-        throw std::runtime_error("failed to submit draw command buffer!");
+    {
+        ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::Submit);
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit draw command buffer!");
+        }
     }
+    inFlightSubmitSerials[currentFrame] = ++submitSerial;
+    frameAllocator->endFrame(submitSerial);
+    recycleUploadWaits();
+    retireOverflowStaging();
+    framePacer.onSubmit(currentFrame);
 
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -2285,7 +4483,11 @@ void VulkanCube::drawFrame()
 
     presentInfo.pImageIndices = &imageIndex;
 
-    result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    {
+        ScopedPhaseTimer timer(frameProfiler, FrameProfiler::Phase::Present);
+        result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    }
+    frameProfiler.onFrameEnd();
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
         framebufferResized = false;
@@ -2295,7 +4497,11 @@ void VulkanCube::drawFrame()
         throw std::runtime_error("failed to present swap chain image!");
     }
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    ++frameNumber;
+    if (framePacer.consumeSettingsChanged()) {
+        applyFramePacing();
+    }
 }
 
 VkShaderModule VulkanCube::createShaderModule(const std::vector<uint32_t>& code)
@@ -2326,9 +4532,14 @@ VkSurfaceFormatKHR VulkanCube::chooseSwapSurfaceFormat(const std::vector<VkSurfa
 
 VkPresentModeKHR VulkanCube::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
 {
-    for (const auto& availablePresentMode : availablePresentModes) {
-        if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            return availablePresentMode;
+    // 吞吐模式用 FIFO 让呈现引擎限速; 低延迟模式优先 MAILBOX, 其次 IMMEDIATE, 新帧不必排在旧帧后面
+    if (!framePacer.lowLatency()) {
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    for (VkPresentModeKHR preferred : { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR }) {
+        if (std::find(availablePresentModes.begin(), availablePresentModes.end(), preferred) != availablePresentModes.end()) {
+            return preferred;
         }
     }
 
@@ -2387,8 +4598,8 @@ bool VulkanCube::isDeviceSuitable(VkPhysicalDevice device)
 
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-    bool swapChainAdequate = false;
-    if (extensionsSupported) {
+    bool swapChainAdequate = config.headless;
+    if (extensionsSupported && !config.headless) {
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
         swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
     }
@@ -2399,6 +4610,42 @@ bool VulkanCube::isDeviceSuitable(VkPhysicalDevice device)
     return queueFamilyIndices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
 }
 
+bool VulkanCube::isDeviceExtensionAvailable(VkPhysicalDevice device, const char* name)
+{
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto& extension : availableExtensions) {
+        if (strcmp(extension.extensionName, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool VulkanCube::isDescriptorIndexingSupported(VkPhysicalDevice device)
+{
+    if (!isDeviceExtensionAvailable(device, VK_KHR_MAINTENANCE3_EXTENSION_NAME) ||
+        !isDeviceExtensionAvailable(device, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+        return false;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures{};
+    descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features2{};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &descriptorIndexingFeatures;
+    vkGetPhysicalDeviceFeatures2(device, &features2);
+
+    // 长度可变、部分绑定、绑定后可更新的纹理数组, 片元着色器里用非一致的下标访问
+    return descriptorIndexingFeatures.runtimeDescriptorArray && descriptorIndexingFeatures.descriptorBindingVariableDescriptorCount
+        && descriptorIndexingFeatures.descriptorBindingPartiallyBound && descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind
+        && descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending && descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing;
+}
+
 bool VulkanCube::checkDeviceExtensionSupport(VkPhysicalDevice device)
 {
     uint32_t extensionCount;
@@ -2407,7 +4654,8 @@ bool VulkanCube::checkDeviceExtensionSupport(VkPhysicalDevice device)
     std::vector<VkExtensionProperties> availableExtensions(extensionCount);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-    std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    auto extensions = getRequiredDeviceExtensions();
+    std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
     for (const auto& extension : availableExtensions) {
         requiredExtensions.erase(extension.extensionName);
@@ -2416,6 +4664,14 @@ bool VulkanCube::checkDeviceExtensionSupport(VkPhysicalDevice device)
     return requiredExtensions.empty();
 }
 
+std::vector<const char*> VulkanCube::getRequiredDeviceExtensions() const
+{
+    if (config.headless) {
+        return {};
+    }
+    return deviceExtensions;
+}
+
 QueueFamilyIndices VulkanCube::findQueueFamilies(VkPhysicalDevice device)
 {
     QueueFamilyIndices queueFamilyIndices;
@@ -2430,6 +4686,11 @@ QueueFamilyIndices VulkanCube::findQueueFamilies(VkPhysicalDevice device)
     for (const auto& queueFamily : queueFamilies) {
         if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
             queueFamilyIndices.graphicsFamily = i;
+            // 无窗口模式没有 surface, 呈现队列只是图形队列的别名
+            if (config.headless) {
+                queueFamilyIndices.presentFamily = i;
+                break;
+            }
         }
 
         VkBool32 presentSupport = false;
@@ -2446,11 +4707,33 @@ QueueFamilyIndices VulkanCube::findQueueFamilies(VkPhysicalDevice device)
         ++i;
     }
 
+    for (uint32_t family = 0; family < queueFamilyCount; ++family) {
+        VkQueueFlags flags = queueFamilies[family].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !queueFamilyIndices.computeFamily.has_value()) {
+            queueFamilyIndices.computeFamily = family;
+        }
+        // 纹理按块行分段拷贝, 要求图像拷贝的粒度是单个纹素
+        const VkExtent3D& granularity = queueFamilies[family].minImageTransferGranularity;
+        bool texelGranularity = granularity.width == 1 && granularity.height == 1 && granularity.depth == 1;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && texelGranularity
+            && !queueFamilyIndices.transferFamily.has_value()) {
+            queueFamilyIndices.transferFamily = family;
+        }
+    }
+
     return queueFamilyIndices;
 }
 
 std::vector<const char*> VulkanCube::getRequiredExtensions()
 {
+    if (config.headless) {
+        std::vector<const char*> extensions;
+        if (enableValidationLayers) {
+            extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+        }
+        return extensions;
+    }
+
     uint32_t glfwExtensionCount = 0;
     const char** glfwExtensions;
     glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
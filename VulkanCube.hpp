@@ -3,6 +3,23 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <vk_mem_alloc.h>
+
+#include "FrameCapture.hpp"
+#include "FramePacer.hpp"
+#include "QualityController.hpp"
+#include "GpuProfiler.hpp"
+#include "FrameProfiler.hpp"
+#include "Tracer.hpp"
+#include "MassScene.hpp"
+#include "CommandRecorder.hpp"
+#include "TransferQueue.hpp"
+#include "VertexPacking.hpp"
+#include "MeshImport.hpp"
+#include "MeshCache.hpp"
+#include "TextureStreamer.hpp"
+#include "FrameAllocator.hpp"
+
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
@@ -23,10 +40,19 @@
 #include <set>
 #include <unordered_map>
 #include <queue>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
 
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    // 不支持图形的计算队列族, 用于异步计算; 没有时为空
+    std::optional<uint32_t> computeFamily;
+    // 只支持传输的队列族 (通常对应独立的 DMA 引擎), 用于异步上传; 没有时为空
+    std::optional<uint32_t> transferFamily;
 
     bool isComplete() const noexcept {
         return graphicsFamily.has_value() && presentFamily.has_value();
@@ -39,11 +65,64 @@ struct SwapChainSupportDetails {
     std::vector<VkPresentModeKHR> presentModes;
 };
 
+struct AppConfig {
+    // 无窗口模式: 不创建 GLFW 窗口和 surface, 渲染到离屏图像, 可运行在 lavapipe 等软件驱动上
+    bool headless = false;
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+    // 无窗口模式下渲染的帧数
+    uint32_t frameCount = 600;
+    // 大于 0 时动画时钟每帧固定前进这么多毫秒, 使无窗口渲染的结果可复现
+    uint32_t fixedFrameTimeMS = 0;
+    // 非空时把每一帧回读并写入该目录
+    std::string captureDirectory;
+    std::string captureFormat = "png";
+    FramePacer::Mode pacing = FramePacer::Mode::Auto;
+    // 根据 GPU 帧时间调节 MSAA 和内部渲染比例; 目标为 0 时使用显示器刷新间隔
+    bool adaptiveQuality = true;
+    double targetFrameTimeMS = 0.0;
+    // 非空时在退出前把 GPU 分段耗时统计写入该 JSON 文件
+    std::string gpuProfilePath;
+    // 非空时记录启动、帧阶段和动画的追踪事件, 退出时以 Chrome trace 格式写入该文件
+    std::string tracePath;
+    // 大于 0 时渲染这么多个同时折叠的展开图实例, 代替可交互的单个展开图
+    uint32_t massSceneInstances = 0;
+    // 大场景绘制录制次级命令缓冲区的分区(线程)数, 0 表示按 CPU 核心数选择
+    uint32_t recordThreads = 0;
+    // 非空时大场景的每个实例画这个 OBJ 网格, 代替平面的展开图; 网格按展开图的布局建模, 顶点按 xy 归入最近的面
+    std::string meshPath;
+    // 每个 KTX2 纹理 (带预先生成的 mip 链) 是一种材质, 展开图的面按材质号轮流或随机取用; 为空时只有一种白色材质
+    std::vector<std::string> texturePaths;
+    // 设备支持 VK_KHR_dynamic_rendering 和 VK_KHR_synchronization2 时不创建渲染通道和帧缓冲, 直接渲染到图像视图
+    bool dynamicRendering = true;
+};
+
+// 每帧的常量, 从 FrameAllocator 分配, 用动态偏移绑定; 随绘制变化的模型矩阵在 DrawConstants 里
 struct UniformBufferObject {
-    alignas(16) glm::mat4 model;
     alignas(16) glm::mat4 projView;
 };
 
+// 与 shaders/vert.glsl、mass_vert.glsl、frag.glsl 共用的推送常量: 模型矩阵, 以及按面号的位掩码: 描边的面和画对角线标记的面
+struct DrawConstants {
+    glm::mat4 model{ 1.f };
+    uint32_t outlineMask = 0;
+    uint32_t diagonalMask = 0;
+    // 可交互展开图各个面的材质号, 打包方式见 MassScene::packFaceMaterials; 大场景的材质号在实例数据里
+    std::array<uint32_t, 2> faceMaterials{};
+    // 大场景的顶点位置按 PackedPositions::scale 和 offset 还原
+    glm::vec4 positionScale{ 1.f };
+    glm::vec4 positionOffset{ 0.f };
+};
+static_assert(sizeof(DrawConstants) <= 128, "DrawConstants must fit the 128 bytes of push constants every device supports");
+
+// 与 shaders/frag.glsl 中 std430 布局的 Material 一致; textureIndex 是材质描述符集中纹理数组的下标
+struct Material {
+    glm::vec4 tint{ 1.f };
+    uint32_t textureIndex = 0;
+    std::array<uint32_t, 3> padding{};
+};
+static_assert(sizeof(Material) == 32, "Material must match the std430 layout in shaders/frag.glsl");
+
 class VulkanCube {
 private:
     struct Animation {
@@ -76,7 +155,7 @@ private:
     };
 
 public:
-    explicit VulkanCube();
+    explicit VulkanCube(const AppConfig& config = AppConfig{});
     VulkanCube(const VulkanCube&) = delete;
     VulkanCube& operator=(const VulkanCube&) = delete;
     ~VulkanCube();
@@ -84,14 +163,19 @@ public:
     void run();
 
 private:
+    AppConfig config;
     UniformBufferObject ubo{};
+    glm::mat4 model{ 1.f };
     std::chrono::high_resolution_clock::time_point startTime;
     std::chrono::high_resolution_clock::time_point rotateStartTime;
     std::chrono::high_resolution_clock::time_point currentTime;
+    std::chrono::high_resolution_clock::time_point virtualTime;
     size_t periodTimeMS = 0;
 
     static const size_t s_msCount = 3000;
     std::queue<Animation> animationQueues;
+    // 追踪时间线上动画开始和结束事件的配对 id
+    uint64_t animationTraceId = 0;
     bool moving = false;
     bool is2D = true;
     bool rotating = false;
@@ -105,6 +189,10 @@ private:
 
     void processAnimation();
 
+    std::chrono::high_resolution_clock::time_point animationNow() const;
+
+    void runHeadless();
+
     enum class TranslateType {
         Reset = 0,
         Flod = 1,
@@ -133,68 +221,225 @@ private:
     bool connectAlongAxis(const std::array<FaceInfo, 6>& faceInfos, size_t firstId, Direction direction) const noexcept;
 
 private:
-    GLFWwindow* window;
+    GLFWwindow* window = nullptr;
 
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
-    VkSurfaceKHR surface;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
 
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+    VkSampleCountFlagBits maxMsaaSamples = VK_SAMPLE_COUNT_1_BIT;
     VkDevice device;
+    VmaAllocator allocator = VK_NULL_HANDLE;
+    // 设备内存是否可以由 CPU 直接写入 (resizable BAR 或 UMA), 否则通过暂存缓冲区上传
+    bool directDeviceWrites = false;
 
     VkQueue graphicsQueue;
     VkQueue presentQueue;
-
-    VkSwapchainKHR swapChain;
+    // 有专用计算队列族时才创建; 需要被两个队列访问的缓冲区以 CONCURRENT 模式在这些队列族间共享
+    VkQueue computeQueue = VK_NULL_HANDLE;
+    VkQueue dedicatedTransferQueue = VK_NULL_HANDLE;
+    std::vector<uint32_t> sharedQueueFamilies;
+    // 多重间接绘制相关的可选能力; 设备不支持 VK_KHR_draw_indirect_count 时函数指针为空
+    bool multiDrawIndirectSupported = false;
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+    // 动态渲染: 开启时 RenderTargets 里没有渲染通道和帧缓冲, 附件的布局转换用 synchronization2 屏障显式录制
+    bool dynamicRendering = false;
+    PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+    PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2 = nullptr;
+
+    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
     std::vector<VkImage> swapChainImages;
+    // 无窗口模式下由程序自己分配的离屏图像, 代替交换链图像
+    std::vector<VmaAllocation> offscreenImageAllocations;
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
     std::vector<VkImageView> swapChainImageViews;
-    std::vector<VkFramebuffer> swapChainFramebuffers;
+    // 每次重建交换链加一, 用来识别在后台构建期间过时的渲染目标
+    uint64_t swapChainGeneration = 0;
+
+    // 随画质等级变化的对象: 渲染通道和管线取决于采样数, 附件和帧缓冲还取决于内部渲染比例
+    struct RenderTargets {
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+        float scale = 1.0f;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent2D extent{};
+        uint64_t swapChainGeneration = 0;
+
+        // 动态渲染时渲染通道和帧缓冲都为空
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        VkPipeline trianglePipeline = VK_NULL_HANDLE;
+        VkPipeline massPipeline = VK_NULL_HANDLE;
+        // 支持图形管线库时两条管线各自的四个库 (顶点输入、预光栅化、片元着色器、片元输出), 为空表示管线整体创建
+        std::vector<VkPipeline> triangleLibraries;
+        std::vector<VkPipeline> massLibraries;
+
+        VkImage colorImage = VK_NULL_HANDLE;
+        VmaAllocation colorImageAllocation = VK_NULL_HANDLE;
+        VkImageView colorImageView = VK_NULL_HANDLE;
+
+        VkImage depthImage = VK_NULL_HANDLE;
+        VmaAllocation depthImageAllocation = VK_NULL_HANDLE;
+        VkImageView depthImageView = VK_NULL_HANDLE;
+
+        // 缩放渲染时的 resolve 目标, 渲染结束后再放大拷贝到交换链图像
+        VkImage sceneImage = VK_NULL_HANDLE;
+        VmaAllocation sceneImageAllocation = VK_NULL_HANDLE;
+        VkImageView sceneImageView = VK_NULL_HANDLE;
+
+        std::vector<VkFramebuffer> framebuffers;
+    };
+    RenderTargets renderTargets;
+    // 深度附件格式, 启动时选定, 所有画质等级共用
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    std::future<RenderTargets> pendingRenderTargets;
+
+    // 后台线程创建的管线: 启动时整体创建的管线, 或替换快速链接管线的链接时优化版本
+    struct PipelineSet {
+        VkPipeline trianglePipeline = VK_NULL_HANDLE;
+        VkPipeline massPipeline = VK_NULL_HANDLE;
+        uint64_t buildTimeUS = 0;
+    };
+    std::future<PipelineSet> pendingPipelines;
+    bool graphicsPipelineLibrarySupported = false;
+    std::unique_ptr<QualityController> qualityController;
+    bool upscaleSupported = false;
+
+    std::unique_ptr<GpuProfiler> gpuProfiler;
 
-    VkRenderPass renderPass;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    bool pipelineCacheHit = false;
+    uint64_t pipelineColdBuildUS = 0;
     VkDescriptorSetLayout descriptorSetLayout;
     VkPipelineLayout pipelineLayout;
-    VkPipeline trianglePipeline;
-    VkPipeline linePipeline;
+    std::vector<uint32_t> vertShaderCode;
+    std::vector<uint32_t> fragShaderCode;
 
     VkCommandPool commandPool;
-
-    VkImage colorImage;
-    VkDeviceMemory colorImageMemory;
-    VkImageView colorImageView;
-
-    VkImage depthImage;
-    VkDeviceMemory depthImageMemory;
-    VkImageView depthImageView;
-
-    //uint32_t mipLevels;
-    //VkImage textureImage;
-    //VkDeviceMemory textureImageMemory;
-    //VkImageView textureImageView;
-    //VkSampler textureSampler;
+    VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+    // 大场景的绘制按实例分区, 在多个线程上录制到次级命令缓冲区
+    std::unique_ptr<CommandRecorder> commandRecorder;
+    // 批量异步上传; 本帧图形和计算提交等待过的上传信号量在该帧提交完成后归还
+    std::unique_ptr<TransferQueue> transferQueue;
+    std::vector<VkSemaphore> uploadWaitSemaphores;
+
+    // 材质 (descriptor set 1): 材质参数在一个 SSBO 里, 所有纹理在一个部分绑定、绑定后可更新的描述符数组里,
+    // 着色器按面的材质号取用, 任意多种材质一次绑定一次绘制; 设备不支持描述符索引时只有一个纹理和一种材质. 纹理按 mip 层级渐进上传, 视图从当前驻留的最大层级开始,
+    // 驻留变化时重建视图并增加代数; 每个飞行帧的描述符集在录制前只重写代数变化了的数组元素
+    struct MaterialTexture {
+        std::unique_ptr<TextureStreamer> streamer;
+        VkImageView view = VK_NULL_HANDLE;
+        uint64_t generation = 0;
+    };
+    std::vector<MaterialTexture> materialTextures;
+    std::vector<Material> materials;
+    VkBuffer materialBuffer = VK_NULL_HANDLE;
+    VmaAllocation materialBufferAllocation = VK_NULL_HANDLE;
+    // 纹理数组的长度, 按设备的绑定后更新限制截断; 不支持描述符索引时为 1
+    uint32_t materialTextureCapacity = 0;
+    bool bindlessMaterials = false;
+    VkSampler textureSampler = VK_NULL_HANDLE;
+    VkDescriptorSetLayout materialDescriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool materialDescriptorPool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> materialDescriptorSets;
+    // [飞行帧][纹理] 描述符中写入的视图的代数
+    std::vector<std::vector<uint64_t>> materialDescriptorGenerations;
 
     std::vector<glm::vec3> vertices;
     std::vector<glm::vec3> moved_vertices;
     std::vector<glm::vec3> color;
     std::vector<uint16_t> indices;
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    VmaAllocation vertexBufferAllocation;
     void* vertexBufferMappedPtr = nullptr;
     VkBuffer colorBuffer;
-    VkDeviceMemory colorBufferMemory;
+    VmaAllocation colorBufferAllocation;
     VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    VmaAllocation indexBufferAllocation;
     void* indexBufferMapperPtr = nullptr;
-    static const size_t indexMaxCount = 64;
 
-    std::vector<VkBuffer> uniformBuffers;
-    std::vector<VkDeviceMemory> uniformBuffersMemory;
-    std::vector<void*> uniformBuffersMapped;
+    struct PendingUpload {
+        VkBuffer dstBuffer = VK_NULL_HANDLE;
+        VkDeviceSize dstOffset = 0;
+        std::vector<uint8_t> data;
+    };
+    std::vector<PendingUpload> pendingUploads;
+    // 帧分配器放不下本帧的上传时临时创建的暂存缓冲区, 本帧提交后交给延迟删除队列
+    VkBuffer overflowStagingBuffer = VK_NULL_HANDLE;
+    VmaAllocation overflowStagingAllocation = VK_NULL_HANDLE;
+
+    // 帧常量和帧内上传的暂存数据, 所有飞行帧共用一个环形缓冲区; frameUniformOffset 是本帧常量的动态偏移
+    std::unique_ptr<FrameAllocator> frameAllocator;
+    uint32_t frameUniformOffset = 0;
 
     VkDescriptorPool descriptorPool;
-    std::vector<VkDescriptorSet> descriptorSets;
+    // 只绑定帧常量, 各帧用动态偏移区分, 只需要一个集合
+    VkDescriptorSet descriptorSet;
+
+    // 大场景模式: 实例的静态数据和动画参数放在显存里的 SSBO, 每帧由计算着色器把面变换写入该飞行帧独占的 SSBO
+    std::unique_ptr<MassScene> massScene;
+    std::chrono::high_resolution_clock::time_point massSceneStart;
+    float massSceneSeconds = 0.f;
+    std::vector<uint32_t> massVertShaderCode;
+    // 实例共享的未变形几何, 格式按坐标范围选择, 管线的顶点输入和顶点缓冲区都按它创建; 上传后只保留格式
+    PackedPositions massPositions;
+    PackedIndices massIndices;
+    // 导入的网格命中缓存时映射着缓存文件, 上传直接从映射读取, 上传后关闭
+    std::unique_ptr<MeshCache> massMeshCache;
+    float massBoundingRadius = MassScene::s_boundingRadius;
+    VkDescriptorSetLayout massDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout massPipelineLayout = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> massDescriptorSets;
+    VkBuffer massVertexBuffer = VK_NULL_HANDLE;
+    VmaAllocation massVertexBufferAllocation = VK_NULL_HANDLE;
+    VkBuffer massIndexBuffer = VK_NULL_HANDLE;
+    VmaAllocation massIndexBufferAllocation = VK_NULL_HANDLE;
+    VkBuffer massInstanceBuffer = VK_NULL_HANDLE;
+    VmaAllocation massInstanceBufferAllocation = VK_NULL_HANDLE;
+    VkBuffer massAnimationBuffer = VK_NULL_HANDLE;
+    VmaAllocation massAnimationBufferAllocation = VK_NULL_HANDLE;
+    std::vector<VkBuffer> massTransformBuffers;
+    std::vector<VmaAllocation> massTransformAllocations;
+    VkDescriptorSetLayout foldDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout foldPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline foldPipeline = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> foldDescriptorSets;
+    // 异步计算时每个飞行帧一个计算命令缓冲区, 图形提交在顶点着色阶段等待对应的信号量
+    std::vector<VkCommandBuffer> computeCommandBuffers;
+    std::vector<VkSemaphore> foldFinishedSemaphores;
+    // GPU 剔除: 每个飞行帧一个间接绘制缓冲区, 开头是可见实例数, 之后是紧凑排列的 VkDrawIndexedIndirectCommand
+    bool massCulling = false;
+    VkDescriptorSetLayout cullDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline cullPipeline = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> cullDescriptorSets;
+    std::vector<VkBuffer> massDrawBuffers;
+    std::vector<VmaAllocation> massDrawAllocations;
+
+    // 帧回读环: 每个槽位是一块主机可见的暂存缓冲区, 由飞行帧的 fence 判断拷贝是否完成
+    enum class CaptureState {
+        Free = 0,
+        Pending = 1,
+        Writing = 2,
+    };
+    struct CaptureSlot {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+        VkDeviceSize capacity = 0;
+        std::atomic<CaptureState> state = CaptureState::Free;
+        uint32_t frameIndex = 0;
+        uint64_t frameNumber = 0;
+        VkExtent2D extent{};
+        bool bgra = false;
+    };
+    static const size_t s_captureRingSize = 4;
+    std::array<CaptureSlot, s_captureRingSize> captureSlots;
+    size_t nextCaptureSlot = 0;
+    std::unique_ptr<ImageSequenceWriter> captureWriter;
+    uint64_t frameNumber = 0;
+    uint64_t droppedCaptures = 0;
 
     std::vector<VkCommandBuffer> commandBuffers;
 
@@ -202,6 +447,21 @@ private:
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
     uint32_t currentFrame = 0;
+    // 运行时生效的飞行帧数, 每帧资源按 MAX_FRAMES_IN_FLIGHT 分配
+    uint32_t framesInFlight = 1;
+    FramePacer framePacer;
+    FrameProfiler frameProfiler;
+    VkPresentModeKHR swapChainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+
+    // 延迟删除队列: 资源在最后一次可能使用它的提交完成(对应 fence 触发)之后才销毁
+    struct DeferredDeletion {
+        uint64_t submitSerial;
+        std::function<void()> destroy;
+    };
+    std::deque<DeferredDeletion> deletionQueue;
+    std::vector<uint64_t> inFlightSubmitSerials;
+    uint64_t submitSerial = 0;
+    uint64_t completedSubmitSerial = 0;
 
     bool framebufferResized = false;
 
@@ -212,37 +472,50 @@ private:
     static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 
     void initVulkan() {
+        TRACE_FUNCTION("startup");
         createInstance();
         setupDebugMessenger();
         createSurface();
         pickPhysicalDevice();
         createLogicalDevice();
+        createAllocator();
+        queryMemoryHeaps();
+        framesInFlight = framePacer.framesInFlight();
         createSwapChain();
         createImageViews();
+        createGpuProfiler();
+        createQualityController();
         createRenderPass();
         createDescriptorSetLayout();
+        createPipelineCache();
+        createMassSceneLayout();
         createGraphicsPipeline();
         createCommandPool();
-        createColorResources();
-        createDepthResources();
-        createFramebuffers();
-        //createTextureImage();
-        //createTextureImageView();
-        //createTextureSampler();
+        createColorResources(renderTargets);
+        createDepthResources(renderTargets);
+        createFramebuffers(renderTargets, swapChainImageViews);
+        createMaterials();
+        createTextureSampler();
         //loadModel();
         createVertexBuffer();
         createIndexBuffer();
-        createUniformBuffers();
-        initUBO();
+        createMassSceneBuffers();
+        submitPendingUploads();
+        createFrameAllocator();
+        createCaptureResources();
+        resetUBO();
         addExampleAnimation();
         createDescriptorPool();
         createDescriptorSets();
         createCommandBuffers();
         createSyncObjects();
+        // 没有快速链接的管线可用时, 第一帧之前必须等后台的整体创建完成
+        pollPipelines(renderTargets.trianglePipeline == VK_NULL_HANDLE);
+        dumpAllocatorStats(false);
     }
 
-    void initUBO() {
-        ubo.model = glm::mat4(1.0f);
+    void resetUBO() {
+        model = glm::mat4(1.0f);
         auto view = glm::lookAt(glm::vec3(0.0f, 0.0f, 20.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
         // 计算视场角对应的高度
@@ -255,8 +528,8 @@ private:
         ubo.projView = glm::ortho(-halfWidth, halfWidth, -halfHeight, halfHeight, 0.1f, 100.0f) * view;
         ubo.projView[1][1] *= -1.f;
 
-        for (auto& uboMapped : uniformBuffersMapped) {
-            memcpy(uboMapped, &ubo, sizeof(ubo));
+        if (massScene) {
+            model = massScene->fitTransform(halfWidth, halfHeight);
         }
     }
 
@@ -282,6 +555,19 @@ private:
 
     void recreateSwapChain();
 
+    void retireSwapChain();
+
+    // 资源在本次及之后 extraSubmits 次提交都完成后销毁
+    void deferDestroy(std::function<void()> destroy, uint64_t extraSubmits = 0);
+
+    void collectRetiredResources();
+
+    void flushDeletionQueue();
+
+    void waitForFrameSlot();
+
+    void applyFramePacing();
+
     void createInstance();
 
     void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
@@ -294,53 +580,102 @@ private:
 
     void createLogicalDevice();
 
+    void createAllocator();
+
+    void dumpAllocatorStats(bool detailed);
+
+    void queryMemoryHeaps();
+
     void createSwapChain();
 
+    void createOffscreenImages();
+
     void createImageViews();
 
     void createRenderPass();
 
+    VkRenderPass buildRenderPass(const RenderTargets& targets);
+
     void createDescriptorSetLayout();
 
+    void createPipelineCache();
+
+    void savePipelineCache();
+
+    // frag.glsl 按是否支持无绑定材质编译
+    std::vector<uint32_t> compileFragmentShader();
+
     void createGraphicsPipeline();
 
-    void createFramebuffers();
+    void buildPipelines(RenderTargets& targets);
+
+    void buildPipelineLibraries(RenderTargets& targets);
+
+    VkPipeline createPipelineLibrary(VkGraphicsPipelineLibraryFlagsEXT parts, VkGraphicsPipelineCreateInfo pipelineInfo);
+
+    void linkPipelines(RenderTargets& targets, bool optimize);
+
+    void destroyPipelineLibraries(RenderTargets& targets);
+
+    void requestPipelines(const RenderTargets& targets);
+
+    void pollPipelines(bool wait);
+
+    void createFramebuffers(RenderTargets& targets, const std::vector<VkImageView>& imageViews);
 
     void createCommandPool();
 
-    void createColorResources();
+    void createColorResources(RenderTargets& targets);
+
+    void createDepthResources(RenderTargets& targets);
+
+    void destroyRenderTargets(RenderTargets& targets, bool passAndPipelines);
+
+    VkExtent2D scaledExtent(float scale) const;
+
+    void createGpuProfiler();
+
+    void collectGpuTimings();
+
+    void dumpGpuProfile();
+
+    void createQualityController();
+
+    void requestRenderTargets(const QualityController::Level& level);
 
-    void createDepthResources();
+    void pollRenderTargets();
+
+    void recordUpscale(VkCommandBuffer commandBuffer, uint32_t imageIndex);
 
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 
     VkFormat findDepthFormat();
 
+    void beginSceneRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool secondaries);
+
+    void endSceneRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+
     bool hasStencilComponent(VkFormat format) {
         return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
     }
 
-    //void createTextureImage();
-
-    //void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
+    void createMaterials();
 
     VkSampleCountFlagBits getMaxUsableSampleCount();
 
-    /*
-    void createTextureImageView() {
-        textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
-    }
-    */
+    void createMaterialTextureView(MaterialTexture& texture);
 
-    //void createTextureSampler();
+    void createTextureSampler();
 
-    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
+    void streamTextures();
 
-    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+    void updateMaterialDescriptorSet(uint32_t frameIndex);
 
-    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels);
+    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel = 0);
+
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VmaAllocation& imageAllocation);
 
-    //void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels);
 
     //void loadModel();
 
@@ -348,13 +683,51 @@ private:
 
     void createIndexBuffer();
 
-    void createUniformBuffers();
+    void createFrameAllocator();
+
+    void createMassSceneLayout();
+
+    void createMassSceneBuffers();
+
+    void updateMassScene(uint32_t frameIndex);
+
+    void recordMassFold(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+    void recordMassCull(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+    VkPipeline createComputePipeline(const std::filesystem::path& source, VkPipelineLayout layout);
+
+    uint32_t massPartitionSize() const;
+
+    void recordMassPartition(VkCommandBuffer commandBuffer, uint32_t partition, uint32_t massScope);
 
     void createDescriptorPool();
 
+    void createCaptureResources();
+
+    void recordCapture(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+
+    void collectCompletedCaptures(bool all);
+
+    void finishCapture();
+
     void createDescriptorSets();
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VmaAllocation& allocation,
+        void** mappedPtr = nullptr, VkMemoryPropertyFlags preferredProperties = 0, bool shared = false);
+
+    void createDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VmaAllocation& allocation, void** mappedPtr, bool shared = false);
+
+    void writeBuffer(VkBuffer buffer, VmaAllocation allocation, void* mappedPtr, VkDeviceSize offset, const void* data, VkDeviceSize size);
+
+    void submitPendingUploads();
+
+    void recordPendingUploads(VkCommandBuffer commandBuffer);
+
+    void appendUploadWaits(uint32_t consumer, VkPipelineStageFlags stages, std::vector<VkSemaphore>& waitSemaphores, std::vector<VkPipelineStageFlags>& waitStages);
+
+    void recycleUploadWaits();
+    void retireOverflowStaging();
 
     VkCommandBuffer beginSingleTimeCommands();
 
@@ -362,15 +735,13 @@ private:
 
     void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-
     void createCommandBuffers();
 
     void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
 
     void createSyncObjects();
 
-    void updateUniformBuffer(uint32_t currentImage);
+    void updateUniformBuffer();
 
     void drawFrame();
 
@@ -388,6 +759,12 @@ private:
 
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
 
+    bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char* name);
+
+    bool isDescriptorIndexingSupported(VkPhysicalDevice device);
+
+    std::vector<const char*> getRequiredDeviceExtensions() const;
+
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
 
     std::vector<const char*> getRequiredExtensions();
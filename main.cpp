@@ -1,9 +1,105 @@
-#include "VulkanCube.hpp"
+﻿#include "VulkanCube.hpp"
 #include <iostream>
+#include <string>
 
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+        << "  --headless            render offscreen without a window or surface\n"
+        << "  --frames <n>          number of frames to render in headless mode\n"
+        << "  --size <w>x<h>        render size\n"
+        << "  --fixed-step <ms>     advance the animation clock by a fixed step per headless frame\n"
+        << "  --capture <dir>       write every rendered frame into <dir> as an image sequence\n"
+        << "  --capture-format <f>  ppm or png (default png)\n"
+        << "  --pacing <mode>       latency, throughput or auto (default auto)\n"
+        << "  --target-frame-ms <t> GPU frame time the adaptive quality scaler aims for (default: display refresh)\n"
+        << "  --fixed-quality       keep the maximum MSAA level at full resolution\n"
+        << "  --gpu-profile <file>  write per-pass GPU timings to <file> as JSON on exit\n"
+        << "  --trace <file>        record a Chrome/Perfetto trace of startup, frames and animations into <file>\n"
+        << "  --mass-scene <n>      render <n> independently folding nets with instancing instead of the interactive net\n"
+        << "  --record-threads <n>  threads recording the mass scene into secondary command buffers (default: one per core, at most 16)\n"
+        << "  --mesh <file.obj>     draw this mesh, modelled in the unfolded net's layout, for every net in the mass scene\n"
+        << "  --texture <file.ktx2> add a material textured with this file; repeat for more materials, faces pick among them\n"
+        << "  --render-pass         use render pass and framebuffer objects even when dynamic rendering is available\n";
+}
 
-int main() {
-    VulkanCube app;
+static bool parseArguments(int argc, char** argv, AppConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless") {
+            config.headless = true;
+        }
+        else if (arg == "--frames" && hasValue) {
+            config.frameCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--size" && hasValue) {
+            std::string size = argv[++i];
+            size_t x = size.find('x');
+            if (x == std::string::npos) return false;
+            config.width = static_cast<uint32_t>(std::stoul(size.substr(0, x)));
+            config.height = static_cast<uint32_t>(std::stoul(size.substr(x + 1)));
+        }
+        else if (arg == "--fixed-step" && hasValue) {
+            config.fixedFrameTimeMS = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--capture" && hasValue) {
+            config.captureDirectory = argv[++i];
+        }
+        else if (arg == "--capture-format" && hasValue) {
+            config.captureFormat = argv[++i];
+            if (config.captureFormat != "ppm" && config.captureFormat != "png") return false;
+        }
+        else if (arg == "--target-frame-ms" && hasValue) {
+            config.targetFrameTimeMS = std::stod(argv[++i]);
+        }
+        else if (arg == "--fixed-quality") {
+            config.adaptiveQuality = false;
+        }
+        else if (arg == "--gpu-profile" && hasValue) {
+            config.gpuProfilePath = argv[++i];
+        }
+        else if (arg == "--trace" && hasValue) {
+            config.tracePath = argv[++i];
+        }
+        else if (arg == "--mass-scene" && hasValue) {
+            config.massSceneInstances = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--record-threads" && hasValue) {
+            config.recordThreads = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--mesh" && hasValue) {
+            config.meshPath = argv[++i];
+        }
+        else if (arg == "--texture" && hasValue) {
+            config.texturePaths.push_back(argv[++i]);
+        }
+        else if (arg == "--render-pass") {
+            config.dynamicRendering = false;
+        }
+        else if (arg == "--pacing" && hasValue) {
+            config.pacing = FramePacer::parseMode(argv[++i]);
+        }
+        else {
+            return false;
+        }
+    }
+    return config.width > 0 && config.height > 0;
+}
+
+int main(int argc, char** argv) {
+    AppConfig config;
+    try {
+        if (!parseArguments(argc, argv, config)) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    catch (const std::exception&) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    VulkanCube app(config);
 
     try {
         app.run();
@@ -14,4 +110,4 @@ int main() {
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -1,9 +1,79 @@
 #version 450
+// BINDLESS_MATERIALS 由 VulkanCube::compileFragmentShader 在设备支持描述符索引时定义
+#ifdef BINDLESS_MATERIALS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragFaceUV;
+layout(location = 2) flat in uint fragFace;
+layout(location = 3) flat in uint fragMaterial;
 
 layout(location = 0) out vec4 outColor;
 
+// 与 VulkanCube.hpp 中的 Material 一致
+struct Material {
+    vec4 tint;
+    uint textureIndex;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Materials {
+    Material materials[];
+};
+
+// 所有材质的纹理; 流送中的纹理只包含已经上传的 mip 层级
+#ifdef BINDLESS_MATERIALS
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+#else
+// 不支持描述符索引时只有一个纹理
+layout(set = 1, binding = 1) uniform sampler2D textures[1];
+#endif
+
+// 与 VulkanCube.hpp 中的 DrawConstants 一致; 按面号的位掩码: 描边的面 (选中的面) 和画对角线标记的面
+layout(push_constant) uniform DrawConstants {
+    mat4 model;
+    uint outlineMask;
+    uint diagonalMask;
+    uint faceMaterials[2];
+    vec4 positionScale;
+    vec4 positionOffset;
+} constants;
+
+const vec3 outlineColor = vec3(0.8, 0.0, 0.0);
+const vec3 diagonalColor = vec3(0.8, 0.8, 0.8);
+// 线宽, 单位是像素; 描边只在面内侧
+const float outlineWidth = 3.0;
+const float diagonalWidth = 5.0;
+
+// 到线中心的像素距离转换成覆盖率, 在一个像素内线性过渡以抗锯齿
+float lineCoverage(float pixels, float halfWidth) {
+    return clamp(halfWidth + 0.5 - pixels, 0.0, 1.0);
+}
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+    Material material = materials[fragMaterial];
+#ifdef BINDLESS_MATERIALS
+    // 同一次绘制中不同的面取不同的纹理, 下标不是一致的
+    vec3 texel = texture(textures[nonuniformEXT(material.textureIndex)], fragFaceUV).rgb;
+#else
+    vec3 texel = texture(textures[0], fragFaceUV).rgb;
+#endif
+    vec3 color = fragColor * material.tint.rgb * texel;
+    uint faceBit = 1u << fragFace;
+
+    if ((constants.diagonalMask & faceBit) != 0u) {
+        // 对角线从第 0 个角到第 2 个角, 即 u == v
+        float t = fragFaceUV.x - fragFaceUV.y;
+        float pixels = abs(t) / max(fwidth(t), 1e-6);
+        color = mix(color, diagonalColor, lineCoverage(pixels, diagonalWidth * 0.5));
+    }
+
+    if ((constants.outlineMask & faceBit) != 0u) {
+        // 到最近一条边的像素距离, 相邻的面不会互相覆盖
+        vec2 distances = min(fragFaceUV, 1.0 - fragFaceUV) / max(fwidth(fragFaceUV), vec2(1e-6));
+        float pixels = min(distances.x, distances.y);
+        color = mix(color, outlineColor, lineCoverage(pixels, outlineWidth));
+    }
+
+    outColor = vec4(color, 1.0);
+}
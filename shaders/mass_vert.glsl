@@ -0,0 +1,55 @@
+﻿#version 450
+
+// 每帧的常量, 用动态偏移绑定
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 projView;
+} ubo;
+
+// offset.xyz 是实例的平移; 面的颜色打包成 RGBA8, 面的材质号每个 8 位
+struct NetInstance {
+    vec4 offset;
+    uint faceColors[6];
+    uint faceMaterials[2];
+};
+
+layout(std430, binding = 1) readonly buffer NetInstances {
+    NetInstance instances[];
+};
+
+// 每个实例 6 个面的折叠变换, 按 实例 * 6 + 面 排列
+layout(std430, binding = 2) readonly buffer FaceTransforms {
+    mat4 faceTransforms[];
+};
+
+// 与 frag.glsl 共用的推送常量, 这里读取模型矩阵和顶点位置的还原参数
+layout(push_constant) uniform DrawConstants {
+    mat4 model;
+    uint outlineMask;
+    uint diagonalMask;
+    uint faceMaterials[2];
+    vec4 positionScale;
+    vec4 positionOffset;
+} constants;
+
+// w 是顶点所属的面号; 量化的格式乘 positionScale 加 positionOffset 还原
+layout(location = 0) in vec4 inPosition;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragFaceUV;
+layout(location = 2) flat out uint fragFace;
+layout(location = 3) flat out uint fragMaterial;
+
+// 展开图中每个面 2 x 2 的方格的左下角, 顶点在面内的坐标由位置推出, 导入的网格也适用
+const vec2 faceOrigins[6] = vec2[6](vec2(-4.0, -1.0), vec2(-2.0, -3.0), vec2(-2.0, -1.0), vec2(0.0, -1.0), vec2(0.0, 1.0), vec2(2.0, -1.0));
+
+void main() {
+    vec4 vertex = inPosition * constants.positionScale + constants.positionOffset;
+    uint face = uint(round(vertex.w));
+    uint instance = uint(gl_InstanceIndex);
+    vec4 position = faceTransforms[instance * 6u + face] * vec4(vertex.xyz, 1.0);
+    gl_Position = ubo.projView * constants.model * vec4(position.xyz + instances[instance].offset.xyz, 1.0);
+    fragColor = unpackUnorm4x8(instances[instance].faceColors[face]).rgb;
+    fragFaceUV = clamp((vertex.xy - faceOrigins[face]) * 0.5, 0.0, 1.0);
+    fragFace = face;
+    fragMaterial = bitfieldExtract(instances[instance].faceMaterials[face / 4u], int(face % 4u) * 8, 8);
+}
@@ -1,7 +1,7 @@
 #version 450
 
+// 每帧的常量, 用动态偏移绑定
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
     mat4 projView;
 } ubo;
 
@@ -9,8 +9,29 @@ layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragFaceUV;
+layout(location = 2) flat out uint fragFace;
+layout(location = 3) flat out uint fragMaterial;
+
+// 与 frag.glsl 共用的推送常量, 这里读取模型矩阵和面的材质号, 材质号每个 8 位
+layout(push_constant) uniform DrawConstants {
+    mat4 model;
+    uint outlineMask;
+    uint diagonalMask;
+    uint faceMaterials[2];
+    vec4 positionScale;
+    vec4 positionOffset;
+} constants;
+
+// 每个面 4 个顶点, 按逆时针顺序排列
+const vec2 faceCorners[4] = vec2[4](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
 
 void main() {
-    gl_Position = ubo.projView * ubo.model * vec4(inPosition, 1.0);
+    gl_Position = ubo.projView * constants.model * vec4(inPosition, 1.0);
     fragColor = inColor;
-}
\ No newline at end of file
+    fragFaceUV = faceCorners[gl_VertexIndex % 4];
+    // 6 个面一次绘制, 每个面 4 个顶点
+    uint face = uint(gl_VertexIndex) / 4u;
+    fragFace = face;
+    fragMaterial = bitfieldExtract(constants.faceMaterials[face / 4u], int(face % 4u) * 8, 8);
+}